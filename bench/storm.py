@@ -0,0 +1,263 @@
+#!/usr/bin/env python3
+# NyxStream
+# Author: Jérôme ODIER <jerome.odier@lpsc.in2p3.fr>
+# SPDX-License-Identifier: GPL-2.0-only
+
+# Subscription storm benchmark, for admission control.
+#
+# Start the server, then run this script:
+#
+#   nyx-stream -t tcp://127.0.0.1:18888 -h http://127.0.0.1:19999 &
+#   bench/storm.py --viewers 300 --size 16384
+#
+# A producer streams timestamped frames at 50 fps and an established viewer measures their latency. After 3 s, the
+# given number of WebSocket viewers subscribe at once, and the ones refused with 503 come back after Retry-After. It
+# reports how long the storm took to be admitted, the established viewer's latency before and during the storm, and
+# the "admission" section of /stats.
+
+import os, re, sys, json, time, base64, socket, struct, argparse, selectors, threading, urllib.request
+
+########################################################################################################################
+
+MAGIC = 0x5358594E
+
+########################################################################################################################
+
+def murmur(data, seed = MAGIC):
+
+    M = 0x5BD1E995
+
+    h = (seed ^ len(data)) & 0xFFFFFFFF
+
+    i = 0
+
+    while len(data) - i >= 4:
+        k = struct.unpack_from('<I', data, i)[0]
+        k = (k * M) & 0xFFFFFFFF; k ^= k >> 24; k = (k * M) & 0xFFFFFFFF
+        h = (h * M) & 0xFFFFFFFF; h ^= k
+        i += 4
+
+    r = len(data) - i
+
+    if r == 3: h ^= data[i + 2] << 16
+    if r >= 2: h ^= data[i + 1] << 8
+    if r >= 1: h ^= data[i]; h = (h * M) & 0xFFFFFFFF
+
+    h ^= h >> 13; h = (h * M) & 0xFFFFFFFF; h ^= h >> 15
+
+    return h
+
+########################################################################################################################
+
+def frame(name, payload):
+
+    return struct.pack('<III', MAGIC, murmur(name.encode()), len(payload)) + payload
+
+########################################################################################################################
+
+def upgrade_request(path):
+
+    key = base64.b64encode(os.urandom(16))
+
+    return b'GET ' + path.encode() + b' HTTP/1.1\r\nHost: x\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: ' + key + b'\r\nSec-WebSocket-Version: 13\r\n\r\n'
+
+########################################################################################################################
+
+class Viewer:
+
+    def __init__(self, host, port, path):
+
+        self.s = socket.create_connection((host, port))
+        self.s.sendall(upgrade_request(path))
+
+        self.buf = b''
+
+        while b'\r\n\r\n' not in self.buf:
+            self._read()
+
+        self.buf = self.buf.split(b'\r\n\r\n', 1)[1]
+
+    def _read(self):
+
+        data = self.s.recv(1 << 20)
+
+        if not data:
+            raise IOError('closed')
+
+        self.buf += data
+
+    def _need(self, n):
+
+        while len(self.buf) < n:
+            self._read()
+
+    def recv(self):
+
+        self._need(2)
+
+        op, n, off = self.buf[0] & 0x0F, self.buf[1] & 0x7F, 2
+
+        if n == 126:
+            self._need(4); n = struct.unpack_from('>H', self.buf, 2)[0]; off = 4
+        elif n == 127:
+            self._need(10); n = struct.unpack_from('>Q', self.buf, 2)[0]; off = 10
+
+        self._need(off + n)
+
+        data, self.buf = self.buf[off: off + n], self.buf[off + n:]
+
+        return op, data
+
+########################################################################################################################
+
+def main():
+
+    parser = argparse.ArgumentParser(description = 'Subscription storm benchmark')
+    parser.add_argument('--host', default = '127.0.0.1')
+    parser.add_argument('--tcp', type = int, default = 18888, help = 'producer port')
+    parser.add_argument('--http', type = int, default = 19999, help = 'HTTP port')
+    parser.add_argument('--viewers', type = int, default = 300, help = 'viewers subscribing at once')
+    parser.add_argument('--size', type = int, default = 16384, help = 'frame payload size')
+    parser.add_argument('--timeout', type = float, default = 20.0, help = 'storm timeout, in seconds')
+    parser.add_argument('--stream', default = 'bench/storm')
+    args = parser.parse_args()
+
+    path = '/streams/' + args.stream
+
+    ####################################################################################################################
+    # PRODUCER AND ESTABLISHED VIEWER                                                                                  #
+    ####################################################################################################################
+
+    stop = False
+
+    latencies = []
+
+    def produce():
+
+        producer = socket.create_connection((args.host, args.tcp))
+
+        while not stop:
+            producer.sendall(frame(args.stream, struct.pack('<d', time.time()) + bytes(args.size - 8)))
+            time.sleep(0.02)
+
+    def view():
+
+        viewer = Viewer(args.host, args.http, path)
+        viewer.s.settimeout(1.0)
+
+        while not stop:
+            try:
+                op, data = viewer.recv()
+            except socket.timeout:
+                continue
+            if op == 2 and len(data) >= 20:
+                now = time.time()
+                latencies.append((now, (now - struct.unpack_from('<d', data, 12)[0]) * 1000.0))
+
+    threading.Thread(target = produce, daemon = True).start()
+    threading.Thread(target = view, daemon = True).start()
+
+    time.sleep(3.0)
+
+    ####################################################################################################################
+    # STORM                                                                                                            #
+    ####################################################################################################################
+
+    sel = selectors.DefaultSelector()
+
+    state = {}
+    retry = []
+
+    def connect(i):
+
+        s = socket.create_connection((args.host, args.http))
+        s.setblocking(False)
+        s.sendall(upgrade_request(path))
+
+        state[s] = [i, b'', False]
+
+        sel.register(s, selectors.EVENT_READ)
+
+    t0 = time.time()
+
+    for i in range(args.viewers):
+        connect(i)
+
+    admitted = 0
+    rejected = 0
+    done_at = None
+
+    while time.time() - t0 < args.timeout:
+
+        now = time.time()
+
+        for r in [r for r in retry if r[0] <= now]:
+            retry.remove(r)
+            connect(r[1])
+
+        for key, _ in sel.select(0.05):
+
+            s = key.fileobj
+            st = state[s]
+
+            try:
+                data = s.recv(1 << 20)
+            except BlockingIOError:
+                continue
+
+            if not data:
+                sel.unregister(s)
+                s.close()
+                continue
+
+            if st[2]:
+                continue
+
+            st[1] += data
+
+            if b'\r\n\r\n' in st[1]:
+
+                header = st[1].split(b'\r\n\r\n')[0].decode()
+
+                if ' 101 ' in header.split('\r\n')[0]:
+                    st[2] = True
+                    admitted += 1
+                    if admitted == args.viewers:
+                        done_at = time.time() - t0
+                else:
+                    rejected += 1
+                    m = re.search(r'Retry-After: (\d+)', header)
+                    sel.unregister(s)
+                    s.close()
+                    retry.append((time.time() + (int(m.group(1)) if m else 1), st[0]))
+
+        if done_at is not None and time.time() - t0 > done_at + 3.0:
+            break
+
+    stop = True
+
+    ####################################################################################################################
+    # REPORT                                                                                                           #
+    ####################################################################################################################
+
+    before = sorted(l for t, l in latencies if t < t0)
+    during = sorted(l for t, l in latencies if t >= t0)
+
+    stats = json.load(urllib.request.urlopen(f'http://{args.host}:{args.http}/stats'))
+
+    print(f'admitted {admitted}/{args.viewers} in {done_at if done_at is not None else -1:.2f} s, {rejected} x 503')
+
+    if before:
+        print(f'established viewer before: p50 {before[len(before) // 2]:.1f} ms, max {before[-1]:.1f} ms')
+
+    if during:
+        print(f'established viewer during: p50 {during[len(during) // 2]:.1f} ms, max {during[-1]:.1f} ms, {len(during)} frames')
+
+    print(f'admission {json.dumps(stats.get("admission"))}')
+
+########################################################################################################################
+
+if __name__ == '__main__':
+    main()
+
+########################################################################################################################
@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+# NyxStream
+# Author: Jérôme ODIER <jerome.odier@lpsc.in2p3.fr>
+# SPDX-License-Identifier: GPL-2.0-only
+
+# WebSocket egress benchmark, plain ws versus userspace TLS versus kernel TLS.
+#
+# Start the server in one of the three modes, then run this script against it:
+#
+#   nyx-stream -t tcp://127.0.0.1:18888 -h http://127.0.0.1:19999 &
+#   bench/tls.py --pid $! --url ws://127.0.0.1:19999
+#
+#   nyx-stream -t tcp://127.0.0.1:18888 -h https://127.0.0.1:19443 -c cert.pem -k key.pem &
+#   bench/tls.py --pid $! --url wss://127.0.0.1:19443
+#
+#   nyx-stream -t tcp://127.0.0.1:18888 -h https://127.0.0.1:19443 -c cert.pem -k key.pem -K &
+#   bench/tls.py --pid $! --url wss://127.0.0.1:19443
+#
+# It reports the bytes delivered, the throughput, the server CPU time per stream and per GB, and the "tls" section of
+# /stats (which tells whether kTLS was actually used).
+
+import os, ssl, sys, json, time, base64, socket, struct, argparse, threading, urllib.parse, urllib.request
+
+########################################################################################################################
+
+MAGIC = 0x5358594E
+
+########################################################################################################################
+
+def murmur(data, seed = MAGIC):
+
+    M = 0x5BD1E995
+
+    h = (seed ^ len(data)) & 0xFFFFFFFF
+
+    i = 0
+
+    while len(data) - i >= 4:
+        k = struct.unpack_from('<I', data, i)[0]
+        k = (k * M) & 0xFFFFFFFF; k ^= k >> 24; k = (k * M) & 0xFFFFFFFF
+        h = (h * M) & 0xFFFFFFFF; h ^= k
+        i += 4
+
+    r = len(data) - i
+
+    if r == 3: h ^= data[i + 2] << 16
+    if r >= 2: h ^= data[i + 1] << 8
+    if r >= 1: h ^= data[i]; h = (h * M) & 0xFFFFFFFF
+
+    h ^= h >> 13; h = (h * M) & 0xFFFFFFFF; h ^= h >> 15
+
+    return h
+
+########################################################################################################################
+
+def frame(name, payload):
+
+    return struct.pack('<III', MAGIC, murmur(name.encode()), len(payload)) + payload
+
+########################################################################################################################
+
+def cpu(pid):
+
+    if pid is None:
+        return 0.0
+
+    fields = open(f'/proc/{pid}/stat').read().split(')')[1].split()
+
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+########################################################################################################################
+
+def tls_context():
+
+    ctx = ssl.create_default_context()
+    ctx.check_hostname = False
+    ctx.verify_mode = ssl.CERT_NONE
+
+    return ctx
+
+########################################################################################################################
+
+def subscribe(url, path):
+
+    s = socket.create_connection((url.hostname, url.port))
+
+    if url.scheme == 'wss':
+        s = tls_context().wrap_socket(s)
+
+    key = base64.b64encode(os.urandom(16))
+
+    s.sendall(b'GET ' + path.encode() + b' HTTP/1.1\r\nHost: x\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: ' + key + b'\r\nSec-WebSocket-Version: 13\r\n\r\n')
+
+    header = b''
+
+    while b'\r\n\r\n' not in header:
+        data = s.recv(4096)
+        if not data:
+            raise IOError('closed')
+        header += data
+
+    if b' 101 ' not in header.split(b'\r\n')[0]:
+        raise IOError(header.split(b'\r\n')[0].decode())
+
+    return s, len(header.split(b'\r\n\r\n', 1)[1])
+
+########################################################################################################################
+
+def main():
+
+    parser = argparse.ArgumentParser(description = 'WebSocket egress benchmark, ws vs TLS vs kTLS')
+    parser.add_argument('--url', default = 'ws://127.0.0.1:19999', help = 'ws:// or wss:// base URL of the server')
+    parser.add_argument('--tcp', default = '127.0.0.1:18888', help = 'producer address')
+    parser.add_argument('--pid', type = int, default = None, help = 'server pid, to measure its CPU time')
+    parser.add_argument('--size', type = int, default = 1048576, help = 'frame payload size')
+    parser.add_argument('--count', type = int, default = 1000, help = 'number of frames')
+    parser.add_argument('--subs', type = int, default = 2, help = 'number of subscribers')
+    parser.add_argument('--stream', default = 'bench/tls')
+    args = parser.parse_args()
+
+    url = urllib.parse.urlparse(args.url)
+
+    ####################################################################################################################
+
+    subs = [subscribe(url, '/streams/' + args.stream) for _ in range(args.subs)]
+
+    received = [n for _, n in subs]
+
+    def reader(i, s):
+
+        s.settimeout(2.0)
+
+        try:
+            while True:
+                data = s.recv(1 << 20)
+                if not data:
+                    break
+                received[i] += len(data)
+        except (socket.timeout, ssl.SSLError):
+            pass
+
+    threads = [threading.Thread(target = reader, args = (i, s)) for i, (s, _) in enumerate(subs)]
+
+    time.sleep(0.3)
+
+    ####################################################################################################################
+
+    payload = frame(args.stream, os.urandom(args.size))
+
+    host, port = args.tcp.rsplit(':', 1)
+
+    producer = socket.create_connection((host, int(port)))
+
+    for t in threads:
+        t.start()
+
+    c0 = cpu(args.pid)
+    t0 = time.time()
+
+    for _ in range(args.count):
+        producer.sendall(payload)
+
+    for t in threads:
+        t.join()
+
+    c1 = cpu(args.pid)
+    t1 = time.time() - 2.0
+
+    ####################################################################################################################
+
+    total = sum(received)
+
+    scheme = 'https' if url.scheme == 'wss' else 'http'
+
+    stats = json.load(urllib.request.urlopen(f'{scheme}://{url.hostname}:{url.port}/stats', context = tls_context() if scheme == 'https' else None))
+
+    gb = total / 1e9
+
+    print(f'{args.url}: frame size {args.size} B, {args.count} frames, {args.subs} subscribers')
+    print(f'received {gb:.2f} GB in {t1 - t0:.2f} s, {gb / (t1 - t0):.2f} GB/s')
+    print(f'server cpu {c1 - c0:.2f} s, {(c1 - c0) / args.subs:.2f} s per stream, {(c1 - c0) / gb if gb > 0 else 0:.2f} s per GB')
+    print(f'tls {json.dumps(stats.get("tls"))}')
+
+########################################################################################################################
+
+if __name__ == '__main__':
+    main()
+
+########################################################################################################################
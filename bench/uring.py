@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+# NyxStream
+# Author: Jérôme ODIER <jerome.odier@lpsc.in2p3.fr>
+# SPDX-License-Identifier: GPL-2.0-only
+
+# Producer ingest benchmark, io_uring versus epoll.
+#
+# Start the server with or without io_uring, then run this script against it, once for the CPU time and once with
+# --syscalls for the system calls (tracing slows the server down, its CPU time is then meaningless):
+#
+#   nyx-stream -t tcp://127.0.0.1:18888 -h http://127.0.0.1:19999 -U &
+#   bench/uring.py --pid $! --size 16384 --count 20000 --producers 4
+#   bench/uring.py --pid $! --size 16384 --count 5000 --producers 4 --rate 500 --syscalls
+#
+# It reports the bytes ingested, the server CPU time per GB, the server system calls per frame (counted with ptrace,
+# every thread present at start) and the "io_uring" section of /stats.
+
+import os, sys, json, time, ctypes, socket, struct, argparse, threading, urllib.request
+
+########################################################################################################################
+
+MAGIC = 0x5358594E
+
+########################################################################################################################
+
+PTRACE_SYSCALL = 24
+PTRACE_DETACH = 17
+PTRACE_SEIZE = 0x4206
+PTRACE_INTERRUPT = 0x4207
+PTRACE_O_TRACESYSGOOD = 1
+
+WALL = 0x40000000
+
+########################################################################################################################
+
+def murmur(data, seed = MAGIC):
+
+    M = 0x5BD1E995
+
+    h = (seed ^ len(data)) & 0xFFFFFFFF
+
+    i = 0
+
+    while len(data) - i >= 4:
+        k = struct.unpack_from('<I', data, i)[0]
+        k = (k * M) & 0xFFFFFFFF; k ^= k >> 24; k = (k * M) & 0xFFFFFFFF
+        h = (h * M) & 0xFFFFFFFF; h ^= k
+        i += 4
+
+    r = len(data) - i
+
+    if r == 3: h ^= data[i + 2] << 16
+    if r >= 2: h ^= data[i + 1] << 8
+    if r >= 1: h ^= data[i]; h = (h * M) & 0xFFFFFFFF
+
+    h ^= h >> 13; h = (h * M) & 0xFFFFFFFF; h ^= h >> 15
+
+    return h
+
+########################################################################################################################
+
+def frame(name, payload):
+
+    return struct.pack('<III', MAGIC, murmur(name.encode()), len(payload)) + payload
+
+########################################################################################################################
+
+def cpu(pid):
+
+    if pid is None:
+        return 0.0
+
+    fields = open(f'/proc/{pid}/stat').read().split(')')[1].split()
+
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+########################################################################################################################
+
+def stats(args):
+
+    return json.load(urllib.request.urlopen(f'http://{args.host}:{args.http}/stats'))
+
+########################################################################################################################
+
+class Tracer(threading.Thread):
+
+    # Counts the system calls of every thread of a process, a syscall-stop is either an entry or an exit
+
+    def __init__(self, pid):
+
+        super().__init__(daemon = True)
+
+        self.pid = pid
+        self.stops = 0
+        self.done = False
+        self.ready = threading.Event()
+
+    def run(self):
+
+        libc = ctypes.CDLL(None, use_errno = True)
+        libc.ptrace.argtypes = [ctypes.c_long, ctypes.c_long, ctypes.c_void_p, ctypes.c_void_p]
+        libc.ptrace.restype = ctypes.c_long
+
+        tids = [int(tid) for tid in os.listdir(f'/proc/{self.pid}/task')]
+
+        try:
+            for tid in tids:
+                if libc.ptrace(PTRACE_SEIZE, tid, None, ctypes.c_void_p(PTRACE_O_TRACESYSGOOD)) < 0:
+                    raise OSError(ctypes.get_errno(), f'cannot trace {tid}')
+                libc.ptrace(PTRACE_INTERRUPT, tid, None, None)
+        finally:
+            self.ready.set()
+
+        # Threads blocked for good are detached when this thread exits
+
+        while tids:
+
+            tid, status = os.waitpid(-1, WALL)
+
+            if os.WIFEXITED(status) or os.WIFSIGNALED(status):
+                tids.remove(tid)
+                continue
+
+            if self.done:
+                libc.ptrace(PTRACE_DETACH, tid, None, None)
+                tids.remove(tid)
+                continue
+
+            if os.WSTOPSIG(status) == 0x85:
+                self.stops += 1
+                libc.ptrace(PTRACE_SYSCALL, tid, None, None)
+            else:
+                libc.ptrace(PTRACE_SYSCALL, tid, None, ctypes.c_void_p(0 if os.WSTOPSIG(status) == 5 else os.WSTOPSIG(status)))
+
+    def syscalls(self):
+
+        return self.stops // 2
+
+########################################################################################################################
+
+def main():
+
+    parser = argparse.ArgumentParser(description = 'Producer ingest benchmark, io_uring vs epoll')
+    parser.add_argument('--host', default = '127.0.0.1')
+    parser.add_argument('--tcp', type = int, default = 18888, help = 'producer port')
+    parser.add_argument('--http', type = int, default = 19999, help = 'HTTP port, for /stats')
+    parser.add_argument('--pid', type = int, default = None, help = 'server pid, to measure its CPU time and system calls')
+    parser.add_argument('--size', type = int, default = 16384, help = 'frame payload size')
+    parser.add_argument('--count', type = int, default = 20000, help = 'number of frames per producer')
+    parser.add_argument('--producers', type = int, default = 4, help = 'number of producers')
+    parser.add_argument('--rate', type = float, default = 0.0, help = 'frames per second per producer, 0 for no limit')
+    parser.add_argument('--syscalls', action = 'store_true', help = 'count the server system calls, needs --pid')
+    parser.add_argument('--stream', default = 'bench/uring')
+    args = parser.parse_args()
+
+    ####################################################################################################################
+
+    producers = [socket.create_connection((args.host, args.tcp)) for _ in range(args.producers)]
+
+    payloads = [frame(f'{args.stream}/{k}', os.urandom(args.size)) for k in range(args.producers)]
+
+    def produce(k):
+
+        t0 = time.time()
+
+        for i in range(args.count):
+
+            producers[k].sendall(payloads[k])
+
+            if args.rate > 0.0:
+                delay = t0 + (i + 1) / args.rate - time.time()
+                if delay > 0.0:
+                    time.sleep(delay)
+
+    threads = [threading.Thread(target = produce, args = (k,)) for k in range(args.producers)]
+
+    time.sleep(0.3)
+
+    ####################################################################################################################
+
+    frames_in = stats(args)['frames_in']
+
+    expected = frames_in + args.count * args.producers
+
+    tracer = None
+
+    if args.syscalls and args.pid is not None:
+        tracer = Tracer(args.pid)
+        tracer.start()
+        tracer.ready.wait()
+
+    c0 = cpu(args.pid)
+    t0 = time.time()
+
+    for t in threads:
+        t.start()
+
+    for t in threads:
+        t.join()
+
+    # Counted before polling /stats, whose requests are system calls too
+
+    if tracer is not None:
+        time.sleep(0.5)
+        syscalls = tracer.syscalls()
+
+    while frames_in < expected and time.time() - t0 < 120.0:
+        time.sleep(0.01)
+        frames_in = stats(args)['frames_in']
+
+    c1 = cpu(args.pid)
+    t1 = time.time()
+
+    if tracer is not None:
+        tracer.done = True
+
+    ####################################################################################################################
+
+    frames = args.count * args.producers - (expected - frames_in)
+
+    gb = frames * len(payloads[0]) / 1e9
+
+    uring = stats(args).get('io_uring')
+
+    print(f'frame size {args.size} B, {args.count} frames x {args.producers} producers, {"unpaced" if args.rate <= 0.0 else f"{args.rate:g} fps each"}')
+    print(f'ingested {frames} frames, {gb:.2f} GB in {t1 - t0:.2f} s, {gb / (t1 - t0):.2f} GB/s')
+
+    if tracer is not None:
+        print(f'server syscalls {syscalls}, {syscalls / frames if frames > 0 else 0:.2f} per frame (traced, cpu not meaningful)')
+    else:
+        print(f'server cpu {c1 - c0:.2f} s, {(c1 - c0) / gb if gb > 0 else 0:.2f} s per GB')
+
+    print(f'io_uring {json.dumps(uring)}')
+
+########################################################################################################################
+
+if __name__ == '__main__':
+    main()
+
+########################################################################################################################
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+# NyxStream
+# Author: Jérôme ODIER <jerome.odier@lpsc.in2p3.fr>
+# SPDX-License-Identifier: GPL-2.0-only
+
+# Raw subscriber egress benchmark, copy versus zero-copy.
+#
+# Start the server with a raw subscriber endpoint, then run this script once per frame size:
+#
+#   nyx-stream -t tcp://127.0.0.1:18888 -h http://127.0.0.1:19999 -S tcp://127.0.0.1:18890 -U -Z 65536 &
+#   bench/zerocopy.py --pid $! --size 262144 --count 500 --subs 3
+#
+# Run it again with -Z 0 (copy only) for the baseline. It reports the server CPU time spent sending, the bytes each
+# subscriber received and the "zerocopy" section of /stats.
+
+import os, sys, json, time, socket, struct, argparse, threading, urllib.request
+
+########################################################################################################################
+
+MAGIC = 0x5358594E
+
+########################################################################################################################
+
+def murmur(data, seed = MAGIC):
+
+    M = 0x5BD1E995
+
+    h = (seed ^ len(data)) & 0xFFFFFFFF
+
+    i = 0
+
+    while len(data) - i >= 4:
+        k = struct.unpack_from('<I', data, i)[0]
+        k = (k * M) & 0xFFFFFFFF; k ^= k >> 24; k = (k * M) & 0xFFFFFFFF
+        h = (h * M) & 0xFFFFFFFF; h ^= k
+        i += 4
+
+    r = len(data) - i
+
+    if r == 3: h ^= data[i + 2] << 16
+    if r >= 2: h ^= data[i + 1] << 8
+    if r >= 1: h ^= data[i]; h = (h * M) & 0xFFFFFFFF
+
+    h ^= h >> 13; h = (h * M) & 0xFFFFFFFF; h ^= h >> 15
+
+    return h
+
+########################################################################################################################
+
+def frame(name, payload):
+
+    return struct.pack('<III', MAGIC, murmur(name.encode()), len(payload)) + payload
+
+########################################################################################################################
+
+def cpu(pid):
+
+    if pid is None:
+        return 0.0
+
+    fields = open(f'/proc/{pid}/stat').read().split(')')[1].split()
+
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+########################################################################################################################
+
+def main():
+
+    parser = argparse.ArgumentParser(description = 'Raw subscriber egress benchmark')
+    parser.add_argument('--host', default = '127.0.0.1')
+    parser.add_argument('--tcp', type = int, default = 18888, help = 'producer port')
+    parser.add_argument('--http', type = int, default = 19999, help = 'HTTP port, for /stats')
+    parser.add_argument('--raw', type = int, default = 18890, help = 'raw subscriber port')
+    parser.add_argument('--pid', type = int, default = None, help = 'server pid, to measure its CPU time')
+    parser.add_argument('--size', type = int, default = 262144, help = 'frame payload size')
+    parser.add_argument('--count', type = int, default = 500, help = 'number of frames')
+    parser.add_argument('--subs', type = int, default = 3, help = 'number of raw subscribers')
+    parser.add_argument('--stream', default = 'bench/zerocopy')
+    args = parser.parse_args()
+
+    ####################################################################################################################
+
+    subs = []
+
+    for _ in range(args.subs):
+        s = socket.create_connection((args.host, args.raw))
+        s.sendall(json.dumps({'subscribe': args.stream}).encode() + b'\n')
+        subs.append(s)
+
+    time.sleep(0.3)
+
+    ####################################################################################################################
+
+    received = [0] * args.subs
+
+    def reader(i, s):
+
+        s.settimeout(3.0)
+
+        try:
+            while True:
+                data = s.recv(1 << 22)
+                if not data:
+                    break
+                received[i] += len(data)
+        except socket.timeout:
+            pass
+
+    threads = [threading.Thread(target = reader, args = (i, s)) for i, s in enumerate(subs)]
+
+    ####################################################################################################################
+
+    frames = [frame(args.stream, struct.pack('<I', k) + os.urandom(args.size - 4)) for k in range(8)]
+
+    producer = socket.create_connection((args.host, args.tcp))
+
+    c0 = cpu(args.pid)
+    t0 = time.time()
+
+    for t in threads:
+        t.start()
+
+    for k in range(args.count):
+        producer.sendall(frames[k % len(frames)])
+        time.sleep(0.002)
+
+    for t in threads:
+        t.join()
+
+    c1 = cpu(args.pid)
+    t1 = time.time() - 3.0
+
+    ####################################################################################################################
+
+    expected = args.count * len(frames[0])
+
+    stats = json.load(urllib.request.urlopen(f'http://{args.host}:{args.http}/stats'))
+
+    print(f'frame size {args.size} B, {args.count} frames, {args.subs} subscribers')
+    print(f'server cpu {c1 - c0:.2f} s, wall {t1 - t0:.2f} s')
+    print(f'received {[r >> 20 for r in received]} MB, complete {[r == expected for r in received]}')
+    print(f'zerocopy {json.dumps(stats.get("zerocopy"))}')
+
+########################################################################################################################
+
+if __name__ == '__main__':
+    main()
+
+########################################################################################################################
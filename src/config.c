@@ -58,7 +58,21 @@ bool nyx_load_config(
     str_t *mqtt_url,
     str_t *mqtt_username,
     str_t *mqtt_password,
-    str_t *poll_ms
+    str_t *poll_ms,
+    str_t *record,
+    str_t *record_dir,
+    str_t *tls_cert,
+    str_t *tls_key,
+    str_t *upstream,
+    str_t *shed_lag_ms,
+    str_t *sub_url,
+    str_t *stream_bps,
+    str_t *addr_bps,
+    str_t *cluster_node,
+    str_t *cluster,
+    str_t *zerocopy,
+    str_t *images,
+    str_t *admit
 ) {
     /*----------------------------------------------------------------------------------------------------------------*/
 
@@ -84,6 +98,20 @@ bool nyx_load_config(
     *mqtt_username = mg_json_get_str(json, "$.mqtt_username");
     *mqtt_password = mg_json_get_str(json, "$.mqtt_password");
     *poll_ms = mg_json_get_str(json, "$.poll_ms");
+    *record = mg_json_get_str(json, "$.record");
+    *record_dir = mg_json_get_str(json, "$.record_dir");
+    *tls_cert = mg_json_get_str(json, "$.tls_cert");
+    *tls_key = mg_json_get_str(json, "$.tls_key");
+    *upstream = mg_json_get_str(json, "$.upstream");
+    *shed_lag_ms = mg_json_get_str(json, "$.shed_lag_ms");
+    *sub_url = mg_json_get_str(json, "$.sub_url");
+    *stream_bps = mg_json_get_str(json, "$.stream_bps");
+    *addr_bps = mg_json_get_str(json, "$.addr_bps");
+    *cluster_node = mg_json_get_str(json, "$.cluster_node");
+    *cluster = mg_json_get_str(json, "$.cluster");
+    *zerocopy = mg_json_get_str(json, "$.zerocopy");
+    *images = mg_json_get_str(json, "$.images");
+    *admit = mg_json_get_str(json, "$.admit");
 
     /*----------------------------------------------------------------------------------------------------------------*/
 
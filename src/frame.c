@@ -0,0 +1,142 @@
+/* NyxStream
+ * Author: Jérôme ODIER <jerome.odier@lpsc.in2p3.fr>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "nyx-stream.h"
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_frame *nyx_frame_new(uint32_t hash, uint64_t ingest_ms, size_t size, BUFF_t data)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct nyx_frame *result = nyx_memory_alloc(sizeof(struct nyx_frame) + size);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    result->refs = 1U;
+    result->hash = hash;
+    result->ingest_ms = ingest_ms;
+    result->size = size;
+
+    if(data != NULL && size > 0x00)
+    {
+        memcpy(result->data, data, size);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_frame *nyx_frame_retain(struct nyx_frame *frame)
+{
+    frame->refs++;
+
+    return frame;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_frame_release(struct nyx_frame *frame)
+{
+    if(frame != NULL && --frame->refs == 0U)
+    {
+        nyx_memory_free(frame);
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_fifo_push(struct nyx_fifo *fifo, struct nyx_frame *frame)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(fifo->len == fifo->cap)
+    {
+        const size_t cap = fifo->cap > 0U ? 2U * fifo->cap : 16U;
+
+        struct nyx_frame **frames = nyx_memory_alloc(cap * sizeof(struct nyx_frame *));
+
+        for(size_t i = 0; i < fifo->len; i++)
+        {
+            frames[i] = fifo->frames[(fifo->head + i) % fifo->cap];
+        }
+
+        nyx_memory_free(fifo->frames);
+
+        fifo->frames = frames;
+        fifo->head = 0U;
+        fifo->cap = cap;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    fifo->frames[(fifo->head + fifo->len++) % fifo->cap] = nyx_frame_retain(frame);
+
+    fifo->bytes += frame->size;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_frame *nyx_fifo_peek(const struct nyx_fifo *fifo)
+{
+    return fifo->len > 0U ? fifo->frames[fifo->head] : NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_frame *nyx_fifo_at(const struct nyx_fifo *fifo, size_t idx)
+{
+    return idx < fifo->len ? fifo->frames[(fifo->head + idx) % fifo->cap] : NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_frame *nyx_fifo_pop(struct nyx_fifo *fifo)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(fifo->len == 0U)
+    {
+        return NULL;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct nyx_frame *result = fifo->frames[fifo->head];
+
+    fifo->head = (fifo->head + 1U) % fifo->cap;
+    fifo->len--;
+
+    fifo->bytes -= result->size;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_fifo_clear(struct nyx_fifo *fifo)
+{
+    while(fifo->len > 0U)
+    {
+        nyx_frame_release(nyx_fifo_pop(fifo));
+    }
+
+    nyx_memory_free(fifo->frames);
+
+    memset(fifo, 0x00, sizeof(struct nyx_fifo));
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
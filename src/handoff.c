@@ -0,0 +1,279 @@
+/* NyxStream
+ * Author: Jérôme ODIER <jerome.odier@lpsc.in2p3.fr>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "nyx-stream.h"
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#define HANDOFF_ENV "NYX_HANDOFF_FD"
+
+#define HANDOFF_FD 3
+
+#define HANDOFF_TIMEOUT_MS 5000
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _set_timeout(const int sock)
+{
+    const struct timeval tv = {
+        .tv_sec = HANDOFF_TIMEOUT_MS / 1000,
+        .tv_usec = (HANDOFF_TIMEOUT_MS % 1000) * 1000,
+    };
+
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+int nyx_handoff_spawn(str_t *argv, int *pid)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    int pair[2];
+
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+    {
+        return -1;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    *pid = fork();
+
+    if(*pid < 0)
+    {
+        close(pair[0]);
+        close(pair[1]);
+
+        return -1;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(*pid == 0)
+    {
+        /* The new binary only inherits its end of the pair, the sockets come over it */
+
+        if(dup2(pair[1], HANDOFF_FD) < 0 || fcntl(HANDOFF_FD, F_SETFD, 0) < 0)
+        {
+            _exit(127);
+        }
+
+        close_range(HANDOFF_FD + 1, ~0U, 0);
+
+        char value[16];
+
+        snprintf(value, sizeof(value), "%d", HANDOFF_FD);
+
+        setenv(HANDOFF_ENV, value, 1);
+
+        execvp(argv[0], argv);
+
+        _exit(127);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    close(pair[1]);
+
+    _set_timeout(pair[0]);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return pair[0];
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_handoff_abort(int sock, int pid)
+{
+    close(sock);
+
+    kill(pid, SIGKILL);
+
+    waitpid(pid, NULL, 0);
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+int nyx_handoff_attach(void)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    STR_t value = getenv(HANDOFF_ENV);
+
+    if(value == NULL)
+    {
+        return -1;
+    }
+
+    const int sock = atoi(value);
+
+    /* Not for the processes this one will spawn */
+
+    unsetenv(HANDOFF_ENV);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    _set_timeout(sock);
+
+    return sock;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_handoff_send(int sock, int fd, BUFF_t buff, size_t size)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    uint8_t control[CMSG_SPACE(sizeof(int))];
+
+    memset(control, 0x00, sizeof(control));
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(size_t done = 0U; done < size;)
+    {
+        struct iovec iov = {
+            .iov_base = (uint8_t *) buff + done,
+            .iov_len = size - done,
+        };
+
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+        };
+
+        /* The descriptor rides along with the first byte */
+
+        if(fd >= 0 && done == 0U)
+        {
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+
+            memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        }
+
+        const ssize_t result = sendmsg(sock, &msg, MSG_NOSIGNAL);
+
+        if(result < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        done += (size_t) result;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_handoff_recv(int sock, int *fd, buff_t buff, size_t size)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    uint8_t control[CMSG_SPACE(sizeof(int))];
+
+    if(fd != NULL)
+    {
+        *fd = -1;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(size_t done = 0U; done < size;)
+    {
+        struct iovec iov = {
+            .iov_base = (uint8_t *) buff + done,
+            .iov_len = size - done,
+        };
+
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+
+        const ssize_t result = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+
+        if(result <= 0)
+        {
+            if(result < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            goto _err;
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            {
+                int received;
+
+                memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+
+                if(fd != NULL && *fd < 0) {
+                    *fd = received;
+                }
+                else {
+                    close(received);
+                }
+            }
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        done += (size_t) result;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return true;
+
+_err:
+    if(fd != NULL && *fd >= 0)
+    {
+        close(*fd);
+
+        *fd = -1;
+    }
+
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,137 @@
+/* NyxStream
+ * Author: Jérôme ODIER <jerome.odier@lpsc.in2p3.fr>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "nyx-stream.h"
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+/* Rows are summed vertically first, contiguous loops the compiler vectorizes, then each bin of sums is folded */
+
+/* Pixels are loaded with memcpy, the payload follows the frame header and is not aligned */
+
+#define IMAGE_KERNEL(name, pixel_t, acc_t)                                                                              \
+static void name(const uint8_t *src, const size_t stride, const uint32_t x, const uint32_t y, const uint32_t w, const uint32_t h, const uint32_t bin, uint8_t *dst, acc_t *acc) \
+{                                                                                                                       \
+    const uint32_t out_w = w / bin;                                                                                     \
+    const uint32_t out_h = h / bin;                                                                                     \
+                                                                                                                        \
+    const acc_t area = (acc_t) (bin * bin);                                                                             \
+                                                                                                                        \
+    for(uint32_t oy = 0U; oy < out_h; oy++)                                                                             \
+    {                                                                                                                   \
+        memset(acc, 0x00, w * sizeof(acc_t));                                                                           \
+                                                                                                                        \
+        for(uint32_t k = 0U; k < bin; k++)                                                                              \
+        {                                                                                                               \
+            const uint8_t *row = src + (size_t) (y + oy * bin + k) * stride + (size_t) x * sizeof(pixel_t);             \
+                                                                                                                        \
+            for(uint32_t i = 0U; i < w; i++)                                                                            \
+            {                                                                                                           \
+                pixel_t v;                                                                                              \
+                memcpy(&v, row + (size_t) i * sizeof(pixel_t), sizeof(pixel_t));                                        \
+                acc[i] += (acc_t) v;                                                                                    \
+            }                                                                                                           \
+        }                                                                                                               \
+                                                                                                                        \
+        uint8_t *out = dst + (size_t) oy * out_w * sizeof(pixel_t);                                                     \
+                                                                                                                        \
+        for(uint32_t ox = 0U; ox < out_w; ox++)                                                                         \
+        {                                                                                                               \
+            acc_t sum = 0;                                                                                              \
+                                                                                                                        \
+            for(uint32_t k = 0U; k < bin; k++)                                                                          \
+            {                                                                                                           \
+                sum += acc[ox * bin + k];                                                                               \
+            }                                                                                                           \
+                                                                                                                        \
+            const pixel_t v = (pixel_t) (sum / area);                                                                   \
+            memcpy(out + (size_t) ox * sizeof(pixel_t), &v, sizeof(pixel_t));                                           \
+        }                                                                                                               \
+    }                                                                                                                   \
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+IMAGE_KERNEL(_bin_u8, uint8_t, uint32_t)
+
+IMAGE_KERNEL(_bin_u16, uint16_t, uint32_t)
+
+IMAGE_KERNEL(_bin_u32, uint32_t, uint64_t)
+
+IMAGE_KERNEL(_bin_f32, float, float)
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+size_t nyx_pixel_size(uint32_t type)
+{
+    switch(type)
+    {
+        case NYX_PIXEL_U8: return sizeof(uint8_t);
+        case NYX_PIXEL_U16: return sizeof(uint16_t);
+        case NYX_PIXEL_U32: return sizeof(uint32_t);
+        case NYX_PIXEL_F32: return sizeof(float);
+        default: return 0U;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_image_view(uint32_t type, BUFF_t src, uint32_t src_width, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t bin, buff_t dst)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const size_t pixel_size = nyx_pixel_size(type);
+
+    const size_t stride = (size_t) src_width * pixel_size;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(bin <= 1U)
+    {
+        /* Plain crop, one copy per row */
+
+        for(uint32_t i = 0U; i < h; i++)
+        {
+            memcpy((uint8_t *) dst + (size_t) i * w * pixel_size, (const uint8_t *) src + (size_t) (y + i) * stride + (size_t) x * pixel_size, (size_t) w * pixel_size);
+        }
+
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Accumulators for one output row, at most 8 bytes per input column */
+
+    uint64_t *acc = nyx_memory_alloc((size_t) w * sizeof(uint64_t));
+
+    switch(type)
+    {
+        case NYX_PIXEL_U8:
+            _bin_u8(src, stride, x, y, w, h, bin, dst, (uint32_t *) acc);
+            break;
+
+        case NYX_PIXEL_U16:
+            _bin_u16(src, stride, x, y, w, h, bin, dst, (uint32_t *) acc);
+            break;
+
+        case NYX_PIXEL_U32:
+            _bin_u32(src, stride, x, y, w, h, bin, dst, (uint64_t *) acc);
+            break;
+
+        case NYX_PIXEL_F32:
+            _bin_f32(src, stride, x, y, w, h, bin, dst, (float *) acc);
+            break;
+    }
+
+    nyx_memory_free(acc);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
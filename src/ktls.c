@@ -0,0 +1,256 @@
+/* NyxStream
+ * Author: Jérôme ODIER <jerome.odier@lpsc.in2p3.fr>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#include "nyx-stream.h"
+
+#include "external/mongoose.h"
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+#if MG_TLS == MG_TLS_OPENSSL && defined(HAVE_KTLS)
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+/* OpenSSL reserves these BIO controls and flags for its socket BIO, */
+/* mongoose's BIO has to implement them to get kernel TLS offload... */
+
+#ifndef BIO_CTRL_SET_KTLS
+#define BIO_CTRL_SET_KTLS 72
+#endif
+
+#ifndef BIO_CTRL_SET_KTLS_SEND_CTRL_MSG
+#define BIO_CTRL_SET_KTLS_SEND_CTRL_MSG 74
+#endif
+
+#ifndef BIO_CTRL_CLEAR_KTLS_CTRL_MSG
+#define BIO_CTRL_CLEAR_KTLS_CTRL_MSG 75
+#endif
+
+#define KTLS_FLAG_TX_CTRL_MSG 0x1000
+
+#define KTLS_FLAG_TX 0x4000
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+/* Same layout as OpenSSL's internal `struct tls_crypto_info_all` */
+
+struct ktls_crypto_info
+{
+    union
+    {
+        struct tls12_crypto_info_aes_gcm_128 gcm128;
+        struct tls12_crypto_info_aes_gcm_256 gcm256;
+        struct tls12_crypto_info_aes_ccm_128 ccm128;
+        struct tls12_crypto_info_chacha20_poly1305 chacha20poly1305;
+    };
+
+    size_t tls_crypto_info_len;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static int s_ex_index = -1;
+
+static int (* s_write)(BIO *, const char *, int) = NULL;
+
+static long (* s_ctrl)(BIO *, int, long, void *) = NULL;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static int _write(BIO *bio, const char *buff, int size)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(BIO_test_flags(bio, KTLS_FLAG_TX_CTRL_MSG) == 0)
+    {
+        return s_write(bio, buff, size);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Records other than application data (alerts, tickets) are typed with a control message */
+
+    const struct mg_connection *conn = (struct mg_connection *) BIO_get_data(bio);
+
+    uint8_t control[CMSG_SPACE(sizeof(uint8_t))];
+
+    struct iovec iov = {
+        .iov_base = (void *) buff,
+        .iov_len = (size_t) size,
+    };
+
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint8_t));
+
+    *CMSG_DATA(cmsg) = (uint8_t) (intptr_t) BIO_get_ex_data(bio, s_ex_index);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const ssize_t result = sendmsg((int) (size_t) conn->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    if(result < 0)
+    {
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            BIO_set_retry_write(bio);
+        }
+
+        return -1;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return (int) result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static long _ctrl(BIO *bio, int cmd, long larg, void *parg)
+{
+    const struct mg_connection *conn = (struct mg_connection *) BIO_get_data(bio);
+
+    switch(cmd)
+    {
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        case BIO_CTRL_FLUSH:
+            /* Records are sent as soon as they are written, nothing to flush */
+            return 1;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        case BIO_CTRL_SET_KTLS:
+            /* Only egress is offloaded, ingest stays in mongoose's TLS buffers */
+            if(larg != 0 && parg != NULL)
+            {
+                const struct ktls_crypto_info *crypto_info = (struct ktls_crypto_info *) parg;
+
+                const int fd = (int) (size_t) conn->fd;
+
+                if(setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0
+                   &&
+                   setsockopt(fd, SOL_TLS, TLS_TX, crypto_info, (socklen_t) crypto_info->tls_crypto_info_len) == 0
+                ) {
+                    BIO_set_flags(bio, KTLS_FLAG_TX);
+
+                    return 1;
+                }
+            }
+            return 0;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        case BIO_CTRL_GET_KTLS_SEND:
+            return BIO_test_flags(bio, KTLS_FLAG_TX) != 0;
+
+        case BIO_CTRL_GET_KTLS_RECV:
+            return 0;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        case BIO_CTRL_SET_KTLS_SEND_CTRL_MSG:
+            BIO_set_ex_data(bio, s_ex_index, (void *) (intptr_t) larg);
+            BIO_set_flags(bio, KTLS_FLAG_TX_CTRL_MSG);
+            return 0;
+
+        case BIO_CTRL_CLEAR_KTLS_CTRL_MSG:
+            BIO_clear_flags(bio, KTLS_FLAG_TX_CTRL_MSG);
+            return 0;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        default:
+            return s_ctrl(bio, cmd, larg, parg);
+
+        /*------------------------------------------------------------------------------------------------------------*/
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_ktls_init(struct mg_connection *conn)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_tls *tls = (struct mg_tls *) conn->tls;
+
+    if(tls == NULL || tls->ssl == NULL || tls->bm == NULL)
+    {
+        return false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_ex_index < 0)
+    {
+        s_ex_index = BIO_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Each connection has its own BIO method, mongoose's handlers are the same for all of them */
+
+    s_write = BIO_meth_get_write(tls->bm);
+    s_ctrl = BIO_meth_get_ctrl(tls->bm);
+
+    BIO_meth_set_write(tls->bm, _write);
+    BIO_meth_set_ctrl(tls->bm, _ctrl);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* OpenSSL hands the record keys to the BIO once the handshake is done */
+
+    SSL_set_options(tls->ssl, SSL_OP_ENABLE_KTLS);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_ktls_enabled(const struct mg_connection *conn)
+{
+    const struct mg_tls *tls = (struct mg_tls *) conn->tls;
+
+    return tls != NULL && tls->ssl != NULL && BIO_get_ktls_send(SSL_get_wbio(tls->ssl));
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+#else
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_ktls_init(__NYX_UNUSED__ struct mg_connection *conn)
+{
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_ktls_enabled(__NYX_UNUSED__ const struct mg_connection *conn)
+{
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+#endif
+/*--------------------------------------------------------------------------------------------------------------------*/
@@ -6,6 +6,7 @@
 /*--------------------------------------------------------------------------------------------------------------------*/
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "nyx-stream.h"
 
@@ -107,3 +108,44 @@ buff_t nyx_memory_realloc(buff_t buff, size_t size)
 }
 
 /*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_buffer_append(struct nyx_buffer *buffer, BUFF_t data, size_t size)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(buffer->len + size > buffer->size)
+    {
+        size_t new_size = buffer->size > 0x00 ? buffer->size : 4096U;
+
+        while(new_size < buffer->len + size)
+        {
+            new_size *= 2U;
+        }
+
+        buffer->buf = nyx_memory_realloc(buffer->buf, buffer->size = new_size);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(data != NULL && size > 0x00)
+    {
+        memcpy((uint8_t *) buffer->buf + buffer->len, data, size);
+    }
+
+    buffer->len += size;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_buffer_free(struct nyx_buffer *buffer)
+{
+    nyx_memory_free(buffer->buf);
+
+    buffer->buf = NULL;
+    buffer->len = 0x00;
+    buffer->size = 0x00;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
@@ -5,11 +5,17 @@
 
 /*--------------------------------------------------------------------------------------------------------------------*/
 
+#include <time.h>
+#include <errno.h>
 #include <getopt.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
 
 #include "nyx-stream.h"
 
@@ -23,6 +29,8 @@ static str_t HTTP_URL = "http://0.0.0.0:9999";
 
 static str_t MQTT_URL = "mqtt://127.0.0.1:1883";
 
+static str_t SUB_URL  = "";
+
 /*--------------------------------------------------------------------------------------------------------------------*/
 
 static str_t MQTT_USERNAME = "";
@@ -36,561 +44,5596 @@ static uint32_t POLL_MS = 10U;
 
 /*--------------------------------------------------------------------------------------------------------------------*/
 
-#define KEEPALIVE_MS 10000U
-
-#define RETRY_MS 1000U
+static str_t RECORD = "";
 
-#define PING_MS 5000U
+static str_t RECORD_DIR = "/var/lib/nyx-stream";
 
-/*--------------------------------------------------------------------------------------------------------------------*/
-/* UTILITIES                                                                                                          */
 /*--------------------------------------------------------------------------------------------------------------------*/
 
-static uint32_t mg_str_to_uint32(const struct mg_str s, const uint32_t default_value)
-{
-    uint32_t parsed_value;
+static bool IO_URING = false;
 
-    return s.len != 0x00
-           &&
-           s.buf != NULL
-           &&
-           mg_str_to_num(s, 10, &parsed_value, sizeof(parsed_value)) ? parsed_value : default_value
-    ;
-}
+static uint32_t ZEROCOPY = 0U;
 
 /*--------------------------------------------------------------------------------------------------------------------*/
-/* SIGNAL                                                                                                             */
+
+static str_t TLS_CERT = "";
+static str_t TLS_KEY = "";
+
+static bool KTLS = false;
+
 /*--------------------------------------------------------------------------------------------------------------------*/
 
-static volatile sig_atomic_t s_signo = 0;
+static str_t UPSTREAM = "";
 
 /*--------------------------------------------------------------------------------------------------------------------*/
 
-static void signal_handler(const int signo)
-{
-    s_signo = signo;
-}
+static uint32_t SHED_LAG_MS = 0U;
 
 /*--------------------------------------------------------------------------------------------------------------------*/
-/* SERVER                                                                                                             */
+
+static uint32_t WORKERS = 0U;
+
+static bool DEDUP = false;
+
 /*--------------------------------------------------------------------------------------------------------------------*/
 
-#define STREAM_MAGIC 0x5358594EU
+static str_t STREAM_BPS = "";
 
-#define STREAM_HEADER_SIZE (4U /* MAGIC */ + 4U /* HASH */ + 4U /* SIZE */)
+static str_t ADDR_BPS = "";
 
 /*--------------------------------------------------------------------------------------------------------------------*/
 
-struct mg_client
-{
-    uint32_t hash;
+static str_t CLUSTER_NODE = "";
 
-    uint32_t period_ms;
-    uint64_t last_send_ms;
+static str_t CLUSTER = "";
 
-    struct mg_connection *conn;
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-    struct mg_client *next;
-};
+static str_t IMAGES = "";
 
 /*--------------------------------------------------------------------------------------------------------------------*/
 
-static struct mg_client *clients = NULL;
+static uint32_t ADMIT = 16U;
 
 /*--------------------------------------------------------------------------------------------------------------------*/
 
-static struct mg_connection *tcp_conn = NULL;
+#define KEEPALIVE_MS 10000U
 
-static struct mg_connection *http_conn = NULL;
+#define DEAD_PEER_MS 30000U
 
-static struct mg_connection *mqtt_conn = NULL;
+#define RETRY_MS 1000U
 
-/*--------------------------------------------------------------------------------------------------------------------*/
-/* CLIENT MANAGEMENT                                                                                                  */
-/*--------------------------------------------------------------------------------------------------------------------*/
+#define PING_MS 5000U
 
-static void add_client(struct mg_connection *conn, const struct mg_str stream, const uint32_t period_ms)
-{
-    /*----------------------------------------------------------------------------------------------------------------*/
+#define UPSTREAM_MIN_BACKOFF_MS 500U
 
-    const uint32_t hash = nyx_hash(stream.len, stream.buf, STREAM_MAGIC);
+#define UPSTREAM_MAX_BACKOFF_MS 30000U
 
-    /*----------------------------------------------------------------------------------------------------------------*/
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-    char addr[INET6_ADDRSTRLEN] = {0};
+#define BATCH_SIZE 65536U
 
-    if(conn->rem.is_ip6) {
-        inet_ntop(AF_INET6, &conn->rem.ip, addr, sizeof(addr));
-    } else {
-        inet_ntop(AF_INET, &conn->rem.ip, addr, sizeof(addr));
-    }
+#define PLAYBACK_SIZE 1048576U
 
-    MG_INFO(("Opening stream %08X (name: `%.*s`, period %u ms, ip `%s`)", hash, (int) stream.len, (str_t) stream.buf, period_ms, addr));
+#define URING_ENTRIES 256U
 
-    /*----------------------------------------------------------------------------------------------------------------*/
-    /* CREATE CLIENT                                                                                                  */
-    /*----------------------------------------------------------------------------------------------------------------*/
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-    struct mg_client *client = nyx_memory_alloc(sizeof(struct mg_client));
+#define EGRESS_CLASSES 4U
 
-    memset(client, 0x00, sizeof(struct mg_client));
+#define EGRESS_DEFAULT_PRIORITY 1U
 
-    /*----------------------------------------------------------------------------------------------------------------*/
+#define EGRESS_MAX_WEIGHT 64U
 
-    client->hash = hash;
-    client->period_ms = period_ms;
-    client->last_send_ms = 0x0000LLU;
+#define EGRESS_QUANTUM 16384U
 
-    client->conn = conn;
-    client->next = clients;
+#define EGRESS_WATERMARK 262144U
 
-    /*----------------------------------------------------------------------------------------------------------------*/
-    /* REGISTER CLIENT                                                                                                */
-    /*----------------------------------------------------------------------------------------------------------------*/
+#define EGRESS_QUEUE_SIZE 16777216U
 
-    clients = client;
+#define FRAGMENT_MIN_SIZE 1024U
 
-    /*----------------------------------------------------------------------------------------------------------------*/
-}
+#define FRAGMENT_MAX_SIZE 16777216U
+
+#define DELAY_BUCKETS 12U
 
 /*--------------------------------------------------------------------------------------------------------------------*/
 
-static void rm_client(const struct mg_connection *conn)
-{
-    for(struct mg_client **pp = &clients; *pp != NULL; pp = &(*pp)->next)
-    {
-        if((*pp)->conn == conn)
-        {
-            /*--------------------------------------------------------------------------------------------------------*/
+#define RATE_BURST_MS 1000U
 
-            char addr[INET6_ADDRSTRLEN] = {0};
+#define RATE_METER_MS 1000U
 
-            if(conn->rem.is_ip6) {
-                inet_ntop(AF_INET6, &conn->rem.ip, addr, sizeof(addr));
-            } else {
-                inet_ntop(AF_INET, &conn->rem.ip, addr, sizeof(addr));
-            }
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-            MG_INFO(("Closing stream `%08X` (ip `%s`)", (*pp)->hash, addr));
+#define INGEST_BUDGET_BYTES 262144U
 
-            /*--------------------------------------------------------------------------------------------------------*/
+#define INGEST_BUDGET_FRAMES 64U
 
-            struct mg_client *dead = *pp; *pp = (*pp)->next;
+#define INGEST_READAHEAD 1048576U
 
-            nyx_memory_free(dead);
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-            break;
+#define RAW_REQUEST_SIZE 4096U
 
-            /*--------------------------------------------------------------------------------------------------------*/
-        }
-    }
-}
+#define RAW_IOVECS 64U
 
 /*--------------------------------------------------------------------------------------------------------------------*/
 
-static void tcp_handler(struct mg_connection *conn, int event, __NYX_UNUSED__ void *event_data)
-{
-    /*----------------------------------------------------------------------------------------------------------------*/
+#define SHED_LEVELS 3U
 
-    /**/ if(event == MG_EV_OPEN)
-    {
-        MG_INFO(("%lu TCP OPEN", conn->id));
-    }
+#define SHED_SAMPLE_MS 100U
 
-    /*----------------------------------------------------------------------------------------------------------------*/
+#define SHED_HOLD_MS 2000U
 
-    else if(event == MG_EV_CLOSE)
-    {
-        MG_INFO(("%lu TCP CLOSE", conn->id));
-    }
+#define SHED_PRIORITY EGRESS_DEFAULT_PRIORITY
 
-    /*----------------------------------------------------------------------------------------------------------------*/
+#define SHED_PERIOD_FACTOR 4U
 
-    else if(event == MG_EV_READ)
-    {
-        /*------------------------------------------------------------------------------------------------------------*/
+#define SHED_MIN_PERIOD_MS 200U
 
-        struct mg_iobuf *iobuf = &conn->recv;
+#define SHED_RETRY_S 5U
 
-        /*------------------------------------------------------------------------------------------------------------*/
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-        size_t off = 0U;
+#define ADMIT_RETRY_S 1U
 
-        while(iobuf->len - off >= STREAM_HEADER_SIZE)
-        {
-            /*--------------------------------------------------------------------------------------------------------*/
+#define ADMIT_RETRY_JITTER_S 5U
 
-            const uint8_t *frame_buff = (const uint8_t *) iobuf->buf + off;
+#define ADMIT_STORM_SIZE 16U
 
-            /*--------------------------------------------------------------------------------------------------------*/
+#define ADMIT_STORM_QUIET_MS 1000U
 
-            const uint32_t header_magic = nyx_read_u32_le(frame_buff + 0);
-            const uint32_t stream_hash  = nyx_read_u32_le(frame_buff + 4);
-            const uint32_t stream_size  = nyx_read_u32_le(frame_buff + 8);
+#define ADMIT_RAMP_MS 2000U
 
-            if(header_magic != STREAM_MAGIC)
-            {
-                off += 1U;
+#define ADMIT_RAMP_PERIOD_MS 1000U
 
-                continue;
-            }
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-            /*--------------------------------------------------------------------------------------------------------*/
+#define CLUSTER_HELLO 0xFFFFFFFFU
 
-            const size_t frame_size = STREAM_HEADER_SIZE + (size_t) stream_size;
+#define CLUSTER_EXPIRE_MS (3U * PING_MS)
 
-            if(iobuf->len - off < frame_size)
-            {
-                /* Incomplete frame, wait... */
+#define CLUSTER_FORWARD_SIZE EGRESS_QUEUE_SIZE
 
-                break;
-            }
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-            /*--------------------------------------------------------------------------------------------------------*/
+#define POOL_QUEUE_SIZE 256U
 
-            if(stream_size > 0U)
-            {
-                /*----------------------------------------------------------------------------------------------------*/
+#define DEDUP_SLOTS 4096U
 
-                const uint64_t now = mg_millis();
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-                /*----------------------------------------------------------------------------------------------------*/
+#define HANDOFF_VERSION 5U
 
-                for(struct mg_client *client = clients; client != NULL; client = client->next)
-                {
-                    if(client->hash == stream_hash && (client->period_ms == 0U || (now - client->last_send_ms) >= (uint64_t) client->period_ms))
-                    {
-                        mg_ws_send(
-                            client->conn,
-                            frame_buff,
-                            frame_size,
-                            WEBSOCKET_OP_BINARY
-                        );
-
-                        client->last_send_ms = now;
-                    }
-                }
+#define HANDOFF_TCP_LISTENER 0U
+#define HANDOFF_HTTP_LISTENER 1U
+#define HANDOFF_PRODUCER 2U
+#define HANDOFF_SESSION 3U
+#define HANDOFF_END 4U
+#define HANDOFF_SUB_LISTENER 5U
+#define HANDOFF_SUB_SESSION 6U
 
-                /*----------------------------------------------------------------------------------------------------*/
-            }
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* UTILITIES                                                                                                          */
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-            /*--------------------------------------------------------------------------------------------------------*/
+static uint32_t mg_str_to_uint32(const struct mg_str s, const uint32_t default_value)
+{
+    uint32_t parsed_value;
 
-            off += frame_size;
+    return s.len != 0x00
+           &&
+           s.buf != NULL
+           &&
+           mg_str_to_num(s, 10, &parsed_value, sizeof(parsed_value)) ? parsed_value : default_value
+    ;
+}
 
-            /*--------------------------------------------------------------------------------------------------------*/
-        }
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-        /*------------------------------------------------------------------------------------------------------------*/
+static bool mg_query_to_uint32(const struct mg_http_message *hm, STR_t name, uint32_t *result, const uint32_t default_value)
+{
+    char buf[16];
 
-        if(off > 0U)
-        {
-            mg_iobuf_del(iobuf, 0U, off);
-        }
+    const int len = mg_http_get_var(
+        &hm->query,
+        name,
+        /*--*/(buf),
+        sizeof(buf)
+    );
 
-        /*------------------------------------------------------------------------------------------------------------*/
-    }
+    *result = len > 0 ? mg_str_to_uint32(mg_str_n(buf, (size_t) len), default_value) : default_value;
 
-    /*----------------------------------------------------------------------------------------------------------------*/
+    return len >= 0;
 }
 
 /*--------------------------------------------------------------------------------------------------------------------*/
 
-static void http_handler(struct mg_connection *conn, int event, void *event_data)
+static bool mg_query_to_uint64(const struct mg_http_message *hm, STR_t name, uint64_t *result, const uint64_t default_value)
 {
-    /*----------------------------------------------------------------------------------------------------------------*/
-    /* MG_EV_HTTP_MSG                                                                                                 */
-    /*----------------------------------------------------------------------------------------------------------------*/
+    char buf[24];
 
-    /**/ if(event == MG_EV_HTTP_MSG)
+    const int len = mg_http_get_var(
+        &hm->query,
+        name,
+        /*--*/(buf),
+        sizeof(buf)
+    );
+
+    if(len <= 0 || mg_str_to_num(mg_str_n(buf, (size_t) len), 10, result, sizeof(uint64_t)) == false)
     {
-        /*------------------------------------------------------------------------------------------------------------*/
+        *result = default_value;
+    }
 
-        struct mg_http_message *hm = event_data;
+    return len >= 0;
+}
 
-        /*------------------------------------------------------------------------------------------------------------*/
-        /* AUTHENTICATION                                                                                             */
-        /*------------------------------------------------------------------------------------------------------------*/
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-        if(TOKEN[0] != '\0')
-        {
-            char token_buf[32];
+static uint64_t wall_millis(void)
+{
+    struct timespec ts;
 
-            const int token_len = mg_http_get_var(
-                &hm->query,
-                "token",
-                /*--*/(token_buf),
-                sizeof(token_buf)
-            );
+    clock_gettime(CLOCK_REALTIME, &ts);
 
-            if(token_len != 16 || memcmp(token_buf, TOKEN, 16) != 0)
-            {
-                mg_http_reply(conn, 403, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "Unauthorized\n");
+    return (uint64_t) ts.tv_sec * 1000U + (uint64_t) ts.tv_nsec / 1000000U;
+}
 
-                return;
-            }
-        }
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-        /*------------------------------------------------------------------------------------------------------------*/
-        /* ROUTE /streams/<device>/<stream>                                                                           */
-        /*------------------------------------------------------------------------------------------------------------*/
+static uint64_t mono_micros(void)
+{
+    struct timespec ts;
 
-        struct mg_str caps[2];
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-        /**/ if(mg_match(hm->uri, mg_str("/streams/*/*"), caps) && caps[0].len > 0 && caps[1].len > 0)
-        {
-            if(mg_strcasecmp(hm->method, mg_str("GET")) == 0)
-            {
-                /*----------------------------------------------------------------------------------------------------*/
+    return (uint64_t) ts.tv_sec * 1000000U + (uint64_t) ts.tv_nsec / 1000U;
+}
 
-                char period_buf[16];
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* SIGNAL                                                                                                             */
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-                const int period_len = mg_http_get_var(
-                    &hm->query,
-                    "period",
-                    /*--*/(period_buf),
-                    sizeof(period_buf)
-                );
+static volatile sig_atomic_t s_signo = 0;
 
-                if(period_len > 0)
-                {
-                    memcpy(conn->data, period_buf, (size_t) period_len + 1);
-                }
-                else
-                {
-                    *(str_t) conn->data = '\0';
-                }
+static volatile sig_atomic_t s_handoff = 0;
 
-                /*----------------------------------------------------------------------------------------------------*/
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-                if(hm->uri.len > 9)
-                {
-                    conn->fn_data = strndup(
-                        hm->uri.buf + 9,
-                        hm->uri.len - 9
-                    );
+static void signal_handler(const int signo)
+{
+    if(signo == SIGUSR2) {
+        s_handoff = 1;
+    }
+    else {
+        s_signo = signo;
+    }
+}
 
-                    if(conn->fn_data != NULL)
-                    {
-                        mg_ws_upgrade(conn, hm, NULL);
-                    }
-                    else
-                    {
-                        mg_http_reply(conn, 400, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "Out of memory error\n");
-                    }
-                }
-                else
-                {
-                    mg_http_reply(conn, 400, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "Missing stream name\n");
-                }
-            }
-            else
-            {
-                mg_http_reply(conn, 405, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "Method not allowed\n");
-            }
-        }
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* SERVER                                                                                                             */
+/*--------------------------------------------------------------------------------------------------------------------*/
 
-        /*------------------------------------------------------------------------------------------------------------*/
-        /* ROUTE /config/poll                                                                                         */
-        /*------------------------------------------------------------------------------------------------------------*/
+struct mg_session
+{
+    bool mux;
 
-        else if(mg_match(hm->uri, mg_str("/config/poll"), NULL))
-        {
-            /**/ if(mg_strcasecmp(hm->method, mg_str("POST")) == 0) {
-                mg_http_reply(conn, 200, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "%u\n", POLL_MS = mg_str_to_uint32(hm->body, POLL_MS));
-            }
-            else if(mg_strcasecmp(hm->method, mg_str("GET")) == 0) {
-                mg_http_reply(conn, 200, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "%u\n", /*------*/ POLL_MS /*------*/);
-            }
-            else {
-                mg_http_reply(conn, 405, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "Method not allowed\n");
-            }
-        }
+    bool raw;
+    struct nyx_fifo raw_queue;
 
-        /*------------------------------------------------------------------------------------------------------------*/
-        /* ROUTE /stop                                                                                                */
-        /*------------------------------------------------------------------------------------------------------------*/
+    bool batch;
+    uint32_t batch_ms;
+    uint64_t batch_start_ms;
+    struct nyx_buffer batch_buf;
 
-        else if(mg_match(hm->uri, mg_str("/stop"), NULL))
-        {
+    uint32_t fragment_size;
+
+    uint64_t last_send_ms;
+    struct nyx_timer idle_timer;
+    struct nyx_timer dead_timer;
+
+    bool out_armed;
+
+    size_t active_cnt;
+    struct mg_client *active_head[EGRESS_CLASSES];
+    struct mg_client *active_tail[EGRESS_CLASSES];
+
+    struct nyx_cursor *replay;
+    struct nyx_timer replay_timer;
+    uint64_t replay_origin_ms;
+    uint64_t replay_base_ms;
+    uint64_t replay_time_ms;
+    size_t replay_size;
+    BUFF_t replay_frame;
+
+    struct mg_connection *conn;
+
+    struct mg_session *next;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct mg_bucket
+{
+    uint64_t rate_bps;
+    int64_t tokens;
+    uint64_t refill_ms;
+
+    uint64_t meter_bytes;
+    uint64_t bps;
+    uint64_t skipped;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct mg_ceiling
+{
+    str_t key;
+
+    uint32_t hash;
+
+    uint64_t rate_bps;
+
+    size_t client_cnt;
+
+    uint64_t meter_bytes;
+    uint64_t bps;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct mg_image
+{
+    str_t key;
+
+    uint32_t hash;
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t type;
+
+    size_t size;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct mg_view
+{
+    uint32_t x;
+    uint32_t y;
+    uint32_t w;
+    uint32_t h;
+
+    uint32_t bin;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct mg_variant
+{
+    struct mg_view view;
+
+    struct nyx_frame *frame;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct mg_client
+{
+    uint32_t hash;
+
+    str_t name;
+
+    uint32_t period_ms;
+    uint64_t last_send_ms;
+    struct nyx_frame *pending;
+    struct nyx_timer pacing_timer;
+
+    uint32_t weight;
+    uint32_t priority;
+    struct nyx_fifo queue;
+    size_t offset;
+    size_t deficit;
+    bool granted;
+    bool active;
+    struct mg_client *next_active;
+
+    uint64_t max_bps;
+    struct mg_bucket rate;
+    struct mg_ceiling *addr_ceiling;
+
+    struct mg_view view;
+
+    uint64_t ramp_ms;
+
+    uint32_t max_age_ms;
+    uint64_t expired;
+    uint64_t age_hist[DELAY_BUCKETS];
+    uint64_t expired_hist[DELAY_BUCKETS];
+
+    struct mg_session *session;
+
+    struct mg_client *next;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct mg_peer
+{
+    str_t name;
+
+    str_t tcp_url;
+    str_t ws_url;
+    str_t http_url;
+
+    bool is_static;
+    uint64_t seen_ms;
+
+    struct mg_connection *fwd_conn;
+
+    struct mg_connection *ws_conn;
+    bool ws_ready;
+
+    uint64_t forwarded;
+    uint64_t forwarded_bytes;
+    uint64_t forward_dropped;
+
+    struct mg_peer *next;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct mg_relay
+{
+    uint32_t hash;
+
+    uint32_t period_ms;
+
+    str_t name;
+
+    struct mg_peer *peer;
+
+    struct mg_relay *next;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct mg_producer
+{
+    uint64_t round;
+    size_t budget_bytes;
+    uint32_t budget_frames;
+
+    bool deferred;
+
+    bool peer;
+
+    bool uring;
+    bool armed;
+    bool parked;
+
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t deferrals;
+    uint64_t throttles;
+
+    struct mg_connection *conn;
+
+    struct mg_producer *next;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct mg_session *sessions = NULL;
+
+static struct mg_client *clients = NULL;
+
+static struct mg_relay *relays = NULL;
+
+static struct mg_producer *producers = NULL;
+
+static struct mg_peer *peers = NULL;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static uint64_t ingest_round = 0U;
+
+static size_t ingest_deferred = 0U;
+
+static bool ingest_uring = false;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct nyx_wheel wheel;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct mg_stats
+{
+    uint64_t frames_in;
+    uint64_t bytes_in;
+
+    uint64_t frames_out;
+    uint64_t bytes_out;
+
+    uint64_t writes;
+
+    uint64_t tls_handshakes;
+    uint64_t ktls_handshakes;
+
+    uint64_t egress_queued;
+    uint64_t egress_dropped;
+
+    uint64_t fragments_out;
+
+    uint64_t raw_writes;
+    uint64_t raw_frames;
+
+    uint64_t delay_cnt;
+    uint64_t delay_sum_ms;
+    uint64_t delay_max_ms;
+    uint64_t delay_hist[DELAY_BUCKETS];
+
+    uint64_t shed_escalations;
+    uint64_t shed_recoveries;
+    uint64_t shed_paced;
+    uint64_t shed_skipped;
+    uint64_t shed_rejected;
+
+    uint64_t admit_paced;
+
+    uint64_t expired;
+
+    uint64_t rate_skipped;
+
+    uint64_t cluster_redirects;
+
+    uint64_t image_views;
+    uint64_t image_bytes;
+    uint64_t image_served;
+    uint64_t image_mismatched;
+    uint64_t image_sum_us;
+    uint64_t image_max_us;
+
+} stats = {0};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct mg_shed
+{
+    uint32_t level;
+
+    uint64_t lag_ms;
+    uint64_t lag_max_ms;
+    uint64_t iteration_max_ms;
+
+    uint64_t changed_ms;
+
+    struct nyx_timer timer;
+
+} shed = {0};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct mg_admit
+{
+    uint64_t round;
+    uint32_t attempts;
+    uint32_t attempts_max;
+
+    uint32_t window_attempts;
+
+    uint64_t admitted;
+    uint64_t rejected;
+
+    bool storm;
+    uint64_t storm_start_ms;
+    uint64_t storm_last_ms;
+    uint64_t storm_attempts;
+    uint64_t storm_lag_max_ms;
+
+    uint64_t storms;
+    uint64_t last_storm_ms;
+    uint64_t max_storm_ms;
+    uint64_t last_storm_attempts;
+    uint64_t last_storm_lag_max_ms;
+
+} admit = {0};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct mg_tls_opts tls_opts = {0};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t record_cnt = 0U;
+
+static uint32_t *record_hashes = NULL;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t stream_ceiling_cnt = 0U;
+
+static struct mg_ceiling *stream_ceilings = NULL;
+
+static size_t addr_ceiling_cnt = 0U;
+
+static struct mg_ceiling *addr_ceilings = NULL;
+
+static struct nyx_timer rate_timer;
+
+static uint64_t rate_meter_ms = 0U;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t image_cnt = 0U;
+
+static struct mg_image *images = NULL;
+
+/* Views computed for the frame being dispatched, kept across frames to avoid reallocating */
+
+static size_t variant_cnt = 0U;
+
+static size_t variant_cap = 0U;
+
+static struct mg_variant *variants = NULL;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct mg_connection *tcp_conn = NULL;
+
+static struct mg_connection *http_conn = NULL;
+
+static struct mg_connection *mqtt_conn = NULL;
+
+static struct mg_connection *sub_conn = NULL;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct mg_connection *upstream_conn = NULL;
+
+static bool upstream_ready = false;
+
+static uint32_t upstream_backoff_ms = UPSTREAM_MIN_BACKOFF_MS;
+
+static struct nyx_timer upstream_timer;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct nyx_ring ring;
+
+static struct nyx_timer cluster_timer;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static unsigned long wakeup_id = 0UL;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* BATCHING                                                                                                           */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void flush_batch(struct mg_session *session, const uint64_t now)
+{
+    if(session->batch_buf.len > 0U)
+    {
+        session->last_send_ms = now;
+
+        mg_ws_send(
+            session->conn,
+            session->batch_buf.buf,
+            session->batch_buf.len,
+            WEBSOCKET_OP_BINARY
+        );
+
+        session->batch_buf.len = 0U;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void flush_batches(const uint64_t now)
+{
+    for(struct mg_session *session = sessions; session != NULL; session = session->next)
+    {
+        if(session->batch_buf.len > 0U && (now - session->batch_start_ms) >= (uint64_t) session->batch_ms)
+        {
+            flush_batch(session, now);
+        }
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void write_frame(struct mg_session *session, const uint8_t *frame_buff, const size_t frame_size, const uint64_t now)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    stats.frames_out += 1U;
+    stats.bytes_out += frame_size;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(session->batch == false)
+    {
+        session->last_send_ms = now;
+
+        mg_ws_send(session->conn, frame_buff, frame_size, WEBSOCKET_OP_BINARY);
+
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(session->batch_buf.len + frame_size > BATCH_SIZE)
+    {
+        flush_batch(session, now);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(frame_size >= BATCH_SIZE)
+    {
+        /* Too big to be batched, send it as is... */
+
+        session->last_send_ms = now;
+
+        mg_ws_send(session->conn, frame_buff, frame_size, WEBSOCKET_OP_BINARY);
+
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(session->batch_buf.len == 0U)
+    {
+        session->batch_start_ms = now;
+    }
+
+    nyx_buffer_append(&session->batch_buf, frame_buff, frame_size);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* RAW SUBSCRIBERS                                                                                                    */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void write_raw(struct mg_session *session, struct nyx_frame *frame)
+{
+    /* Producer format as is, written with the other frames of the iteration */
+
+    stats.frames_out += 1U;
+    stats.bytes_out += frame->size;
+
+    nyx_fifo_push(&session->raw_queue, frame);
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool use_zerocopy(const struct nyx_frame *frame)
+{
+    /* Pinning pages and waiting for the notification only pays off for large frames */
+
+    return ZEROCOPY > 0U && frame->size >= ZEROCOPY && nyx_uring_enabled();
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void flush_raw(struct mg_session *session, const uint64_t now)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_connection *conn = session->conn;
+
+    struct nyx_fifo *queue = &session->raw_queue;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Straight from the frames to the socket, unless mongoose still has bytes to write first */
+
+    while(queue->len > 0U && conn->send.len == 0U && conn->is_closing == false)
+    {
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* ZERO-COPY                                                                                                  */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        struct nyx_frame *head = nyx_fifo_peek(queue);
+
+        if(use_zerocopy(head))
+        {
+            const int32_t result = nyx_uring_send_zc((int) (size_t) conn->fd, head, 0U);
+
+            if(result < 0)
+            {
+                /**/ if(result == -EAGAIN || result == -EINTR)
+                {
+                    break;
+                }
+                else if(result == -EINVAL || result == -EOPNOTSUPP)
+                {
+                    MG_ERROR(("Zero-copy send not supported, copying instead"));
+
+                    ZEROCOPY = 0U;
+
+                    continue;
+                }
+                else if(result != -EBUSY)
+                {
+                    conn->is_closing = 1;
+
+                    return;
+                }
+
+                /* The ring is busy with other sends, this frame is copied instead */
+            }
+            else
+            {
+                stats.raw_writes++;
+                stats.raw_frames++;
+
+                session->last_send_ms = now;
+
+                nyx_fifo_pop(queue);
+
+                if((size_t) result < head->size)
+                {
+                    /* Partially written, the tail goes to mongoose */
+
+                    mg_send(conn, head->data + result, head->size - (size_t) result);
+                }
+
+                nyx_frame_release(head);
+
+                continue;
+            }
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* COPY                                                                                                       */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        struct iovec iov[RAW_IOVECS];
+
+        size_t cnt = 0U;
+
+        for(struct nyx_frame *frame; cnt < RAW_IOVECS && (frame = nyx_fifo_at(queue, cnt)) != NULL && (cnt == 0U || use_zerocopy(frame) == false); cnt++)
+        {
+            iov[cnt].iov_base = frame->data;
+            iov[cnt].iov_len = frame->size;
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        const ssize_t result = writev((int) (size_t) conn->fd, iov, (int) cnt);
+
+        if(result < 0)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                break;
+            }
+
+            conn->is_closing = 1;
+
+            return;
+        }
+
+        stats.raw_writes++;
+        stats.raw_frames += cnt;
+
+        session->last_send_ms = now;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        for(size_t done = (size_t) result; done > 0U;)
+        {
+            struct nyx_frame *frame = nyx_fifo_pop(queue);
+
+            if(done < frame->size)
+            {
+                /* Partially written, the tail goes to mongoose */
+
+                mg_send(conn, frame->data + done, frame->size - done);
+
+                done = 0U;
+            }
+            else
+            {
+                done -= frame->size;
+            }
+
+            nyx_frame_release(frame);
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* The socket is full, mongoose writes the rest once it is writable again */
+
+    for(struct nyx_frame *frame; (frame = nyx_fifo_pop(queue)) != NULL;)
+    {
+        mg_send(conn, frame->data, frame->size);
+
+        nyx_frame_release(frame);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void flush_raws(const uint64_t now)
+{
+    for(struct mg_session *session = sessions; session != NULL; session = session->next)
+    {
+        if(session->raw && session->raw_queue.len > 0U)
+        {
+            flush_raw(session, now);
+        }
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* ADMISSION CONTROL                                                                                                  */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool admit_subscriber(const uint64_t now)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Fresh budget once per loop iteration, shared by WebSocket upgrades and new mux subscriptions */
+
+    if(admit.round != ingest_round)
+    {
+        admit.round = ingest_round;
+        admit.attempts = 0U;
+    }
+
+    admit.attempts++;
+
+    if(admit.attempts_max < admit.attempts)
+    {
+        admit.attempts_max = admit.attempts;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* A storm is a burst of attempts within one load sample, subscriptions admitted during a storm ramp up */
+
+    if(++admit.window_attempts > ADMIT_STORM_SIZE)
+    {
+        if(admit.storm == false)
+        {
+            admit.storm = true;
+            admit.storm_start_ms = now;
+            admit.storm_attempts = admit.window_attempts - 1U;
+            admit.storm_lag_max_ms = 0U;
+
+            admit.storms++;
+
+            MG_ERROR(("Subscription storm, admitting %u per loop iteration and ramping up", ADMIT));
+        }
+
+        admit.storm_last_ms = now;
+    }
+
+    if(admit.storm)
+    {
+        admit.storm_attempts++;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(ADMIT > 0U && admit.attempts > ADMIT)
+    {
+        admit.rejected++;
+
+        return false;
+    }
+
+    admit.admitted++;
+
+    return true;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void admit_update(const uint64_t now, const uint64_t lag_ms)
+{
+    admit.window_attempts = 0U;
+
+    if(admit.storm)
+    {
+        if(admit.storm_lag_max_ms < lag_ms)
+        {
+            admit.storm_lag_max_ms = lag_ms;
+        }
+
+        if(now - admit.storm_last_ms >= ADMIT_STORM_QUIET_MS)
+        {
+            admit.storm = false;
+
+            admit.last_storm_ms = admit.storm_last_ms - admit.storm_start_ms;
+            admit.last_storm_attempts = admit.storm_attempts;
+            admit.last_storm_lag_max_ms = admit.storm_lag_max_ms;
+
+            if(admit.max_storm_ms < admit.last_storm_ms)
+            {
+                admit.max_storm_ms = admit.last_storm_ms;
+            }
+
+            MG_INFO(("Subscription storm over after %llu ms (%llu attempts, loop lag up to %llu ms)", (unsigned long long) admit.last_storm_ms, (unsigned long long) admit.last_storm_attempts, (unsigned long long) admit.last_storm_lag_max_ms));
+        }
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* LOAD SHEDDING                                                                                                      */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static STR_t SHED_ACTIONS[SHED_LEVELS + 1U] = {
+    "none",
+    "slowing down low-priority subscriptions",
+    "skipping frames for full buffers",
+    "rejecting new subscriptions",
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+__NYX_INLINE__ uint32_t shed_period(const struct mg_client *client)
+{
+    if(shed.level < 1U || client->priority > SHED_PRIORITY)
+    {
+        return client->period_ms;
+    }
+
+    /* Saturated, a very long period must not wrap to a short one */
+
+    const uint64_t period_ms = (uint64_t) client->period_ms * SHED_PERIOD_FACTOR;
+
+    return period_ms > UINT32_MAX ? UINT32_MAX : period_ms > SHED_MIN_PERIOD_MS ? (uint32_t) period_ms : SHED_MIN_PERIOD_MS;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+__NYX_INLINE__ uint32_t effective_period(const struct mg_client *client, const uint64_t now)
+{
+    uint32_t period_ms = shed_period(client);
+
+    /* New subscriptions start slow, their period shrinks linearly to the requested one over the ramp */
+
+    if(client->ramp_ms > 0U && now - client->ramp_ms < ADMIT_RAMP_MS)
+    {
+        const uint32_t ramp_period_ms = (uint32_t) ((uint64_t) ADMIT_RAMP_PERIOD_MS * (ADMIT_RAMP_MS - (now - client->ramp_ms)) / ADMIT_RAMP_MS);
+
+        if(period_ms < ramp_period_ms)
+        {
+            period_ms = ramp_period_ms;
+        }
+    }
+
+    return period_ms;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static uint32_t retry_after(const uint32_t retry_s)
+{
+    /* Jittered, so that rejected clients do not all come back in the same second */
+
+    uint32_t jitter;
+
+    mg_random(&jitter, sizeof(jitter));
+
+    return retry_s + jitter % ADMIT_RETRY_JITTER_S;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void shed_reject(struct mg_connection *conn, const uint32_t retry_s)
+{
+    char headers[128];
+
+    mg_snprintf(headers, sizeof(headers), "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\nRetry-After: %u\r\n", retry_after(retry_s));
+
+    mg_http_reply(conn, 503, headers, "Overloaded\n");
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void shed_timer_handler(__NYX_UNUSED__ void *arg)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* How late the loop got to this timer */
+
+    const uint64_t now = mg_millis();
+
+    const uint64_t lag_ms = now - shed.timer.deadline_ms;
+
+    shed.lag_ms = (7U * shed.lag_ms + lag_ms) / 8U;
+
+    if(shed.lag_max_ms < lag_ms)
+    {
+        shed.lag_max_ms = lag_ms;
+    }
+
+    nyx_wheel_schedule(&wheel, &shed.timer, now + SHED_SAMPLE_MS);
+
+    admit_update(now, lag_ms);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(SHED_LAG_MS == 0U)
+    {
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Level n is entered at n times the threshold, and left below half of it once settled */
+
+    /**/ if(shed.level < SHED_LEVELS && shed.lag_ms >= (uint64_t) SHED_LAG_MS * (shed.level + 1U))
+    {
+        shed.level++;
+
+        shed.changed_ms = now;
+
+        stats.shed_escalations++;
+
+        MG_ERROR(("Loop lag %llu ms, load shedding level %u: %s", (unsigned long long) shed.lag_ms, shed.level, SHED_ACTIONS[shed.level]));
+    }
+    else if(shed.level > 0U && shed.lag_ms < (uint64_t) SHED_LAG_MS * shed.level / 2U && now - shed.changed_ms >= SHED_HOLD_MS)
+    {
+        MG_INFO(("Loop lag %llu ms, load shedding level %u: no longer %s", (unsigned long long) shed.lag_ms, shed.level - 1U, SHED_ACTIONS[shed.level]));
+
+        shed.level--;
+
+        shed.changed_ms = now;
+
+        stats.shed_recoveries++;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* RATE LIMITING                                                                                                      */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void bucket_update(struct mg_bucket *bucket, const uint64_t rate_bps, const uint64_t now)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const int64_t depth = (int64_t) (rate_bps * RATE_BURST_MS / 1000U);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(bucket->refill_ms == 0U)
+    {
+        /* Starts full, a new subscriber gets its first frames right away */
+
+        bucket->tokens = depth;
+    }
+    else
+    {
+        bucket->tokens += (int64_t) (bucket->rate_bps * (now - bucket->refill_ms) / 1000U);
+
+        if(bucket->tokens > depth)
+        {
+            bucket->tokens = depth;
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    bucket->rate_bps = rate_bps;
+    bucket->refill_ms = now;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool rate_admit(struct mg_client *client, const size_t size, const uint64_t now)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_bucket *bucket = &client->rate;
+
+    if(bucket->rate_bps > 0U)
+    {
+        bucket_update(bucket, bucket->rate_bps, now);
+
+        /* Any token left lets a whole frame through, the debt is paid before the next one */
+
+        if(bucket->tokens <= 0)
+        {
+            bucket->skipped++;
+
+            stats.rate_skipped++;
+
+            return false;
+        }
+
+        bucket->tokens -= (int64_t) size;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    bucket->meter_bytes += size;
+
+    if(client->addr_ceiling != NULL)
+    {
+        client->addr_ceiling->meter_bytes += size;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct mg_ceiling *find_ceiling(struct mg_ceiling *ceilings, const size_t ceiling_cnt, const uint32_t hash, STR_t key)
+{
+    for(size_t i = 0U; i < ceiling_cnt; i++)
+    {
+        if(ceilings[i].hash == hash && (key == NULL || strcmp(ceilings[i].key, key) == 0))
+        {
+            return &ceilings[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static uint64_t client_rate(const struct mg_client *client)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    uint64_t result = client->max_bps;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* The operator's ceiling for the stream wins over the subscriber's request */
+
+    const struct mg_ceiling *stream_ceiling = find_ceiling(stream_ceilings, stream_ceiling_cnt, client->hash, NULL);
+
+    if(stream_ceiling != NULL && (result == 0U || result > stream_ceiling->rate_bps))
+    {
+        result = stream_ceiling->rate_bps;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* The address ceiling is split evenly, a shared bucket would go to whoever comes first */
+
+    const struct mg_ceiling *addr_ceiling = client->addr_ceiling;
+
+    if(addr_ceiling != NULL && addr_ceiling->client_cnt > 0U)
+    {
+        const uint64_t share_bps = addr_ceiling->rate_bps / addr_ceiling->client_cnt > 0U ? addr_ceiling->rate_bps / addr_ceiling->client_cnt : 1U;
+
+        if(result == 0U || result > share_bps)
+        {
+            result = share_bps;
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void update_rates(const struct mg_client *client, const struct mg_ceiling *addr_ceiling)
+{
+    const uint64_t now = mg_millis();
+
+    for(struct mg_client *curr = clients; curr != NULL; curr = curr->next)
+    {
+        if(curr == client || (addr_ceiling != NULL && curr->addr_ceiling == addr_ceiling))
+        {
+            bucket_update(&curr->rate, client_rate(curr), now);
+        }
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void rate_timer_handler(__NYX_UNUSED__ void *arg)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const uint64_t now = mg_millis();
+
+    const uint64_t elapsed_ms = now > rate_meter_ms ? now - rate_meter_ms : 1U;
+
+    rate_meter_ms = now;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(struct mg_client *client = clients; client != NULL; client = client->next)
+    {
+        client->rate.bps = client->rate.meter_bytes * 1000U / elapsed_ms;
+
+        client->rate.meter_bytes = 0U;
+    }
+
+    for(size_t i = 0U; i < addr_ceiling_cnt; i++)
+    {
+        addr_ceilings[i].bps = addr_ceilings[i].meter_bytes * 1000U / elapsed_ms;
+
+        addr_ceilings[i].meter_bytes = 0U;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    nyx_wheel_schedule(&wheel, &rate_timer, now + RATE_METER_MS);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* EGRESS SCHEDULING                                                                                                  */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+__NYX_INLINE__ size_t egress_backlog(const struct mg_session *session)
+{
+    return session->conn->send.len + session->batch_buf.len + session->raw_queue.bytes;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+__NYX_INLINE__ size_t egress_unit(const struct mg_session *session, const struct mg_client *client, const struct nyx_frame *frame)
+{
+    /* Either the whole frame or its next fragment */
+
+    if(session->fragment_size == 0U || frame->size <= session->fragment_size)
+    {
+        return frame->size;
+    }
+
+    const size_t payload_size = frame->size - STREAM_HEADER_SIZE;
+
+    const size_t chunk_size = session->fragment_size - FRAGMENT_HEADER_SIZE;
+
+    return FRAGMENT_HEADER_SIZE + (payload_size - client->offset < chunk_size ? payload_size - client->offset : chunk_size);
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+__NYX_INLINE__ uint32_t delay_bucket(const uint64_t delay_ms)
+{
+    uint32_t bucket = 0U;
+
+    while(bucket < DELAY_BUCKETS - 1U && delay_ms >= (1LLU << bucket))
+    {
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void record_delay(struct mg_client *client, const size_t frame_size, const uint64_t ingest_ms, const uint64_t now)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const uint64_t delay_ms = now - ingest_ms;
+
+    const uint32_t bucket = delay_bucket(delay_ms);
+
+    /* Age of every delivered frame, for the subscription */
+
+    client->age_hist[bucket]++;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Only small unpaced frames, paced ones are held on purpose */
+
+    if(client->period_ms > 0U || frame_size > EGRESS_QUANTUM)
+    {
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    stats.delay_cnt++;
+    stats.delay_sum_ms += delay_ms;
+
+    if(stats.delay_max_ms < delay_ms)
+    {
+        stats.delay_max_ms = delay_ms;
+    }
+
+    stats.delay_hist[bucket]++;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void write_fragment(struct mg_session *session, const struct nyx_frame *frame, const size_t offset, const size_t size, const uint64_t now)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    static struct nyx_buffer fragment = {0};
+
+    fragment.len = 0U;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    uint8_t header[FRAGMENT_HEADER_SIZE];
+
+    nyx_write_u32_le(header + 0x00, FRAGMENT_MAGIC);
+    nyx_write_u32_le(header + 0x04, frame->hash);
+    nyx_write_u32_le(header + 0x08, (uint32_t) size);
+    nyx_write_u32_le(header + 0x0C, (uint32_t) offset);
+    nyx_write_u32_le(header + 0x10, (uint32_t) (frame->size - STREAM_HEADER_SIZE));
+
+    nyx_buffer_append(&fragment, header, FRAGMENT_HEADER_SIZE);
+
+    nyx_buffer_append(&fragment, frame->data + STREAM_HEADER_SIZE + offset, size);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    write_frame(session, fragment.buf, fragment.len, now);
+
+    stats.fragments_out++;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void expire_frames(struct mg_client *client, const uint64_t now)
+{
+    /* Stale frames are dropped when their turn comes, the newest one is always kept */
+
+    if(client->max_age_ms == 0U)
+    {
+        return;
+    }
+
+    for(struct nyx_frame *frame; client->queue.len > 1U && client->offset == 0U && (frame = nyx_fifo_peek(&client->queue)) != NULL && now - frame->ingest_ms > client->max_age_ms;)
+    {
+        client->expired_hist[delay_bucket(now - frame->ingest_ms)]++;
+
+        client->expired++;
+
+        stats.expired++;
+
+        nyx_frame_release(nyx_fifo_pop(&client->queue));
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void activate_client(struct mg_client *client)
+{
+    struct mg_session *session = client->session;
+
+    client->next_active = NULL;
+
+    if(session->active_tail[client->priority] != NULL) {
+        session->active_tail[client->priority]->next_active = client;
+    }
+    else {
+        session->active_head[client->priority] = client;
+    }
+
+    session->active_tail[client->priority] = client;
+
+    session->active_cnt++;
+
+    client->active = true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void deactivate_client(struct mg_client *client)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_session *session = client->session;
+
+    struct mg_client *prev = NULL;
+
+    for(struct mg_client *curr = session->active_head[client->priority]; curr != client; curr = curr->next_active)
+    {
+        prev = curr;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(prev != NULL) {
+        prev->next_active = client->next_active;
+    }
+    else {
+        session->active_head[client->priority] = client->next_active;
+    }
+
+    if(session->active_tail[client->priority] == client)
+    {
+        session->active_tail[client->priority] = prev;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    session->active_cnt--;
+
+    client->next_active = NULL;
+    client->deficit = 0U;
+    client->granted = false;
+    client->active = false;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void pump_egress(struct mg_session *session, const uint64_t now, const size_t watermark)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Strict priority between classes, deficit round robin by weight within a class */
+
+    for(uint32_t priority = EGRESS_CLASSES; priority-- > 0U && session->active_cnt > 0U;)
+    {
+        while(session->active_head[priority] != NULL)
+        {
+            /*--------------------------------------------------------------------------------------------------------*/
+
+            if(egress_backlog(session) >= watermark)
+            {
+                return;
+            }
+
+            /*--------------------------------------------------------------------------------------------------------*/
+
+            struct mg_client *client = session->active_head[priority];
+
+            expire_frames(client, now);
+
+            if(client->granted == false)
+            {
+                client->deficit += (size_t) EGRESS_QUANTUM * client->weight;
+
+                client->granted = true;
+            }
+
+            /*--------------------------------------------------------------------------------------------------------*/
+
+            struct nyx_frame *frame;
+
+            size_t unit = 0U;
+
+            while((frame = nyx_fifo_peek(&client->queue)) != NULL && (unit = egress_unit(session, client, frame)) <= client->deficit && egress_backlog(session) < watermark)
+            {
+                client->deficit -= unit;
+
+                /**/ if(session->raw)
+                {
+                    write_raw(session, frame);
+
+                    record_delay(client, frame->size, frame->ingest_ms, now);
+                }
+                else if(unit == frame->size)
+                {
+                    write_frame(session, frame->data, frame->size, now);
+
+                    record_delay(client, frame->size, frame->ingest_ms, now);
+                }
+                else
+                {
+                    /* Other subscriptions get their turn between the fragments of a large frame */
+
+                    write_fragment(session, frame, client->offset, unit - FRAGMENT_HEADER_SIZE, now);
+
+                    client->offset += unit - FRAGMENT_HEADER_SIZE;
+
+                    if(client->offset < frame->size - STREAM_HEADER_SIZE)
+                    {
+                        continue;
+                    }
+
+                    client->offset = 0U;
+
+                    record_delay(client, frame->size, frame->ingest_ms, now);
+                }
+
+                nyx_frame_release(nyx_fifo_pop(&client->queue));
+            }
+
+            /*--------------------------------------------------------------------------------------------------------*/
+
+            /**/ if(frame == NULL)
+            {
+                /* Queue drained */
+
+                deactivate_client(client);
+            }
+            else if(unit > client->deficit)
+            {
+                /* Round over, next subscription of the class */
+
+                session->active_head[priority] = client->next_active;
+
+                if(session->active_head[priority] == NULL) {
+                    session->active_tail[priority] = NULL;
+                }
+
+                session->active_cnt--;
+
+                client->granted = false;
+
+                activate_client(client);
+            }
+
+            /*--------------------------------------------------------------------------------------------------------*/
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void send_frame(struct mg_client *client, struct nyx_frame **frame, const uint8_t *frame_buff, const size_t frame_size, const uint64_t now)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_session *session = client->session;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(rate_admit(client, frame_size, now) == false)
+    {
+        /* Out of bandwidth, skipped rather than queued */
+
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(session->active_cnt == 0U && egress_backlog(session) < EGRESS_WATERMARK && (session->fragment_size == 0U || frame_size <= session->fragment_size))
+    {
+        /* Nothing is waiting, no need to queue */
+
+        if(session->raw)
+        {
+            if(*frame == NULL)
+            {
+                *frame = nyx_frame_new(client->hash, now, frame_size, frame_buff);
+            }
+
+            write_raw(session, *frame);
+        }
+        else
+        {
+            write_frame(session, frame_buff, frame_size, now);
+        }
+
+        record_delay(client, frame_size, *frame != NULL ? (*frame)->ingest_ms : now, now);
+
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(shed.level >= 2U && egress_backlog(session) >= EGRESS_WATERMARK)
+    {
+        /* Shedding load, this subscriber is not keeping up anyway */
+
+        stats.shed_skipped++;
+
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(*frame == NULL)
+    {
+        *frame = nyx_frame_new(client->hash, now, frame_size, frame_buff);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Live data, the oldest frames are the least useful */
+
+    while(client->queue.len > 0U && client->offset == 0U && client->queue.bytes + frame_size > EGRESS_QUEUE_SIZE)
+    {
+        nyx_frame_release(nyx_fifo_pop(&client->queue));
+
+        stats.egress_dropped++;
+    }
+
+    nyx_fifo_push(&client->queue, *frame);
+
+    stats.egress_queued++;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(client->active == false)
+    {
+        activate_client(client);
+    }
+
+    pump_egress(session, now, EGRESS_WATERMARK);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* IMAGES                                                                                                             */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static const struct mg_image *find_image(const uint32_t hash)
+{
+    for(size_t i = 0U; i < image_cnt; i++)
+    {
+        if(images[i].hash == hash)
+        {
+            return &images[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct mg_view parse_view(const struct mg_str roi, const uint32_t bin)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* A null binning factor means no view, a missing or invalid ROI means the full image */
+
+    struct mg_view result = {0U, 0U, 0U, 0U, bin};
+
+    if(roi.len == 0 || roi.buf == NULL)
+    {
+        return result;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    uint32_t values[4];
+
+    size_t cnt = 0U;
+
+    for(struct mg_str s = roi, value; cnt < 4U && mg_span(s, &value, &s, ',');)
+    {
+        if(mg_str_to_num(value, 10, &values[cnt], sizeof(uint32_t)) == false)
+        {
+            break;
+        }
+
+        cnt++;
+    }
+
+    if(cnt == 4U && values[2] > 0U && values[3] > 0U)
+    {
+        result.x = values[0];
+        result.y = values[1];
+        result.w = values[2];
+        result.h = values[3];
+
+        if(result.bin == 0U) {
+            result.bin = 1U;
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void set_view(struct mg_client *client, const struct mg_view *view)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    memset(&client->view, 0x00, sizeof(struct mg_view));
+
+    const struct mg_image *image = find_image(client->hash);
+
+    if(image == NULL || view->bin == 0U)
+    {
+        /* Not a declared image, or no view requested: full frames */
+
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* The ROI is clipped to the image, then trimmed to whole bins */
+
+    const uint32_t x = view->x < image->width ? view->x : image->width - 1U;
+    const uint32_t y = view->y < image->height ? view->y : image->height - 1U;
+
+    uint32_t w = view->w > 0U && view->w < image->width - x ? view->w : image->width - x;
+    uint32_t h = view->h > 0U && view->h < image->height - y ? view->h : image->height - y;
+
+    uint32_t bin = view->bin < NYX_IMAGE_MAX_BIN ? view->bin : NYX_IMAGE_MAX_BIN;
+
+    if(bin > w) {
+        bin = w;
+    }
+    if(bin > h) {
+        bin = h;
+    }
+
+    w -= w % bin;
+    h -= h % bin;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(x == 0U && y == 0U && w == image->width && h == image->height && bin == 1U)
+    {
+        /* Same as the full frame, shared as is */
+
+        return;
+    }
+
+    client->view.x = x;
+    client->view.y = y;
+    client->view.w = w;
+    client->view.h = h;
+    client->view.bin = bin;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct nyx_frame **view_frame(const struct mg_image *image, const struct mg_view *view, const uint8_t *frame_buff, const uint64_t ingest_ms)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Each distinct view is computed once per frame and shared by all the subscribers asking for it */
+
+    for(size_t i = 0U; i < variant_cnt; i++)
+    {
+        if(memcmp(&variants[i].view, view, sizeof(struct mg_view)) == 0)
+        {
+            return &variants[i].frame;
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(variant_cnt == variant_cap)
+    {
+        variant_cap = variant_cap > 0U ? 2U * variant_cap : 8U;
+
+        variants = nyx_memory_realloc(variants, variant_cap * sizeof(struct mg_variant));
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const size_t payload_size = (size_t) (view->w / view->bin) * (size_t) (view->h / view->bin) * nyx_pixel_size(image->type);
+
+    struct nyx_frame *frame = nyx_frame_new(image->hash, ingest_ms, STREAM_HEADER_SIZE + payload_size, NULL);
+
+    nyx_write_u32_le(frame->data + 0, STREAM_MAGIC);
+    nyx_write_u32_le(frame->data + 4, image->hash);
+    nyx_write_u32_le(frame->data + 8, (uint32_t) payload_size);
+
+    const uint64_t t0 = mono_micros();
+
+    nyx_image_view(image->type, frame_buff + STREAM_HEADER_SIZE, image->width, view->x, view->y, view->w, view->h, view->bin, frame->data + STREAM_HEADER_SIZE);
+
+    const uint64_t elapsed_us = mono_micros() - t0;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    stats.image_views++;
+    stats.image_bytes += frame->size;
+    stats.image_sum_us += elapsed_us;
+
+    if(stats.image_max_us < elapsed_us) {
+        stats.image_max_us = elapsed_us;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_variant *variant = &variants[variant_cnt++];
+
+    variant->view = *view;
+    variant->frame = frame;
+
+    return &variant->frame;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void release_views(void)
+{
+    for(size_t i = 0U; i < variant_cnt; i++)
+    {
+        nyx_frame_release(variants[i].frame);
+    }
+
+    variant_cnt = 0U;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void parse_images(STR_t list)
+{
+    for(struct mg_str s = mg_str(list), entry; mg_span(s, &entry, &s, ',');)
+    {
+        struct mg_str key, shape, dims, type, width, height;
+
+        if(mg_span(entry, &key, &shape, '=') == false || key.len == 0
+           ||
+           mg_span(shape, &dims, &type, ':') == false
+           ||
+           mg_span(dims, &width, &height, 'x') == false
+        ) {
+            MG_ERROR(("Invalid image `%.*s`, expected `<stream>=<width>x<height>:<u8|u16|u32|f32>`", (int) entry.len, entry.buf));
+
+            continue;
+        }
+
+        struct mg_image image;
+
+        memset(&image, 0x00, sizeof(struct mg_image));
+
+        /**/ if(mg_strcmp(type, mg_str("u8")) == 0) image.type = NYX_PIXEL_U8;
+        else if(mg_strcmp(type, mg_str("u16")) == 0) image.type = NYX_PIXEL_U16;
+        else if(mg_strcmp(type, mg_str("u32")) == 0) image.type = NYX_PIXEL_U32;
+        else if(mg_strcmp(type, mg_str("f32")) == 0) image.type = NYX_PIXEL_F32;
+        else
+        {
+            MG_ERROR(("Invalid pixel type `%.*s`, expected `u8`, `u16`, `u32` or `f32`", (int) type.len, type.buf));
+
+            continue;
+        }
+
+        image.width = mg_str_to_uint32(width, 0U);
+        image.height = mg_str_to_uint32(height, 0U);
+
+        if(image.width == 0U || image.height == 0U)
+        {
+            MG_ERROR(("Invalid image size `%.*s`", (int) dims.len, dims.buf));
+
+            continue;
+        }
+
+        image.key = nyx_memory_alloc(key.len + 1U);
+        memcpy(image.key, key.buf, key.len);
+        image.key[key.len] = '\0';
+
+        image.hash = nyx_hash(key.len, key.buf, STREAM_MAGIC);
+
+        image.size = (size_t) image.width * (size_t) image.height * nyx_pixel_size(image.type);
+
+        images = nyx_memory_realloc(images, (image_cnt + 1U) * sizeof(struct mg_image));
+
+        images[image_cnt++] = image;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* TIMERS                                                                                                             */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void idle_timer_handler(void *arg)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_session *session = arg;
+
+    const uint64_t now = mg_millis();
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if((now - session->last_send_ms) < (uint64_t) KEEPALIVE_MS)
+    {
+        /* Some data was sent in the meantime, no need to ping... */
+
+        nyx_wheel_schedule(&wheel, &session->idle_timer, session->last_send_ms + KEEPALIVE_MS);
+
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    mg_ws_send(session->conn, "", 0x00, WEBSOCKET_OP_PING);
+
+    session->last_send_ms = now;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    nyx_wheel_schedule(&wheel, &session->idle_timer, now + KEEPALIVE_MS);
+
+    if(nyx_timer_pending(&session->dead_timer) == false)
+    {
+        nyx_wheel_schedule(&wheel, &session->dead_timer, now + DEAD_PEER_MS);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void dead_timer_handler(void *arg)
+{
+    struct mg_session *session = arg;
+
+    MG_INFO(("%lu WS peer timeout", session->conn->id));
+
+    session->conn->is_closing = 1;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void pacing_timer_handler(void *arg)
+{
+    struct mg_client *client = arg;
+
+    if(client->pending != NULL)
+    {
+        const uint64_t now = mg_millis();
+
+        struct nyx_frame **frame = &client->pending;
+
+        /* The full frame is kept, its view is only computed once it is actually sent */
+
+        const struct mg_image *image = client->view.bin > 0U ? find_image(client->hash) : NULL;
+
+        if(image != NULL && client->pending->size == STREAM_HEADER_SIZE + image->size)
+        {
+            frame = view_frame(image, &client->view, client->pending->data, client->pending->ingest_ms);
+
+            stats.image_served++;
+        }
+
+        send_frame(client, frame, (*frame)->data, (*frame)->size, now);
+
+        client->last_send_ms = now;
+
+        nyx_frame_release(client->pending);
+
+        client->pending = NULL;
+
+        release_views();
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void replay_timer_handler(void *arg)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_session *session = arg;
+
+    const uint64_t now = mg_millis();
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    while(session->conn->send.len < PLAYBACK_SIZE)
+    {
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        if(session->replay_frame == NULL && nyx_cursor_next(session->replay, &session->replay_time_ms, &session->replay_size, &session->replay_frame) == false)
+        {
+            MG_INFO(("%lu WS replay completed", session->conn->id));
+
+            mg_ws_send(session->conn, "", 0x00, WEBSOCKET_OP_CLOSE);
+
+            session->conn->is_draining = 1;
+
+            return;
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        if(session->replay_base_ms == 0x0000LLU)
+        {
+            session->replay_base_ms = session->replay_time_ms;
+        }
+
+        const uint64_t due_ms = session->replay_origin_ms + (session->replay_time_ms - session->replay_base_ms);
+
+        if(due_ms > now)
+        {
+            nyx_wheel_schedule(&wheel, &session->replay_timer, due_ms);
+
+            return;
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        write_frame(session, session->replay_frame, session->replay_size, now);
+
+        session->replay_frame = NULL;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* The peer is slow, retry later... */
+
+    nyx_wheel_schedule(&wheel, &session->replay_timer, now + POLL_MS);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* RELAY                                                                                                              */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct mg_connection *relay_conn(const struct mg_relay *relay)
+{
+    /* Streams owned by a cluster peer are pulled from it, the others from the upstream */
+
+    if(relay->peer != NULL) {
+        return relay->peer->ws_ready ? relay->peer->ws_conn : NULL;
+    }
+    else {
+        return upstream_ready ? upstream_conn : NULL;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void relay_subscribe(const struct mg_relay *relay)
+{
+    struct mg_connection *conn = relay_conn(relay);
+
+    if(conn != NULL)
+    {
+        mg_ws_printf(conn, WEBSOCKET_OP_TEXT, "{%m:%m,%m:%u}", MG_ESC("subscribe"), MG_ESC(relay->name), MG_ESC("period"), relay->period_ms);
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void relay_unsubscribe(const struct mg_relay *relay)
+{
+    struct mg_connection *conn = relay_conn(relay);
+
+    if(conn != NULL)
+    {
+        mg_ws_printf(conn, WEBSOCKET_OP_TEXT, "{%m:%m}", MG_ESC("unsubscribe"), MG_ESC(relay->name));
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void relay_update(const uint32_t hash, const struct mg_str stream)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(UPSTREAM[0] == '\0' && CLUSTER_NODE[0] == '\0')
+    {
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_peer *peer = nyx_ring_lookup(&ring, hash);
+
+    const bool remote = peer != NULL || UPSTREAM[0] != '\0';
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* The upstream subscription follows the strictest local period */
+
+    bool found = false;
+
+    uint32_t period_ms = UINT32_MAX;
+
+    for(const struct mg_client *client = clients; client != NULL; client = client->next)
+    {
+        if(client->hash == hash)
+        {
+            found = true;
+
+            if(period_ms > client->period_ms)
+            {
+                period_ms = client->period_ms;
+            }
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_relay **pp = &relays;
+
+    while(*pp != NULL && (*pp)->hash != hash)
+    {
+        pp = &(*pp)->next;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* LAST LOCAL SUBSCRIBER LEFT OR STREAM OWNED LOCALLY                                                             */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(found == false || remote == false)
+    {
+        if(*pp != NULL)
+        {
+            struct mg_relay *dead = *pp; *pp = (*pp)->next;
+
+            MG_INFO(("Releasing upstream stream %08X (name: `%s`)", dead->hash, dead->name));
+
+            relay_unsubscribe(dead);
+
+            nyx_memory_free(dead->name);
+
+            nyx_memory_free(dead);
+        }
+
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* FIRST LOCAL SUBSCRIBER                                                                                         */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_relay *relay = *pp;
+
+    if(relay == NULL)
+    {
+        if(stream.len == 0U)
+        {
+            return;
+        }
+
+        relay = nyx_memory_alloc(sizeof(struct mg_relay));
+
+        relay->hash = hash;
+        relay->name = nyx_memory_alloc(stream.len + 1U);
+        memcpy(relay->name, stream.buf, stream.len);
+        relay->name[stream.len] = '\0';
+
+        relay->period_ms = UINT32_MAX;
+
+        relay->peer = peer;
+
+        relay->next = relays;
+
+        relays = relay;
+
+        MG_INFO(("Requesting upstream stream %08X (name: `%s`, from `%s`)", hash, relay->name, peer != NULL ? peer->name : UPSTREAM));
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* OWNER CHANGED                                                                                                  */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(relay->peer != peer)
+    {
+        MG_INFO(("Moving upstream stream %08X (name: `%s`, from `%s`)", hash, relay->name, peer != NULL ? peer->name : UPSTREAM));
+
+        relay_unsubscribe(relay);
+
+        relay->peer = peer;
+
+        relay->period_ms = UINT32_MAX;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* PERIOD CHANGED                                                                                                 */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(relay->period_ms != period_ms)
+    {
+        relay->period_ms = period_ms;
+
+        relay_subscribe(relay);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* CLUSTER                                                                                                            */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool parse_member(const struct mg_str spec, struct mg_str *host, struct mg_str *tcp_port, struct mg_str *http_port)
+{
+    struct mg_str rest;
+
+    return mg_span(spec, host, &rest, ':')
+           &&
+           mg_span(rest, tcp_port, http_port, ':')
+           &&
+           host->len > 0 && tcp_port->len > 0 && http_port->len > 0
+    ;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void rebuild_ring(void)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    nyx_ring_clear(&ring);
+
+    nyx_ring_add(&ring, CLUSTER_NODE, NULL);
+
+    for(struct mg_peer *peer = peers; peer != NULL; peer = peer->next)
+    {
+        nyx_ring_add(&ring, peer->name, peer);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Local subscribers of streams that changed hands follow the new owner */
+
+    for(const struct mg_client *client = clients; client != NULL; client = client->next)
+    {
+        relay_update(client->hash, mg_str(client->name));
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool add_peer(const struct mg_str spec, const bool is_static)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_str host, tcp_port, http_port;
+
+    if(parse_member(spec, &host, &tcp_port, &http_port) == false)
+    {
+        MG_ERROR(("Invalid cluster member `%.*s`, expected `<host>:<tcp port>:<http port>`", (int) spec.len, spec.buf));
+
+        return false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(mg_strcmp(spec, mg_str(CLUSTER_NODE)) == 0)
+    {
+        return false;
+    }
+
+    for(struct mg_peer *peer = peers; peer != NULL; peer = peer->next)
+    {
+        if(mg_strcmp(spec, mg_str(peer->name)) == 0)
+        {
+            peer->seen_ms = mg_millis();
+
+            peer->is_static = peer->is_static || is_static;
+
+            return false;
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_peer *peer = nyx_memory_alloc(sizeof(struct mg_peer));
+
+    memset(peer, 0x00, sizeof(struct mg_peer));
+
+    peer->name = mg_mprintf("%.*s", (int) spec.len, spec.buf);
+
+    peer->tcp_url = mg_mprintf("tcp://%.*s:%.*s", (int) host.len, host.buf, (int) tcp_port.len, tcp_port.buf);
+    peer->ws_url = mg_mprintf("ws://%.*s:%.*s/streams%s%s", (int) host.len, host.buf, (int) http_port.len, http_port.buf, TOKEN[0] != '\0' ? "?token=" : "", TOKEN);
+    peer->http_url = mg_mprintf("http://%.*s:%.*s", (int) host.len, host.buf, (int) http_port.len, http_port.buf);
+
+    peer->is_static = is_static;
+    peer->seen_ms = mg_millis();
+
+    peer->next = peers;
+
+    peers = peer;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    MG_INFO(("Cluster member `%s` joined", peer->name));
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void free_peer(struct mg_peer *peer)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* The handlers see a NULL peer from now on */
+
+    if(peer->fwd_conn != NULL)
+    {
+        peer->fwd_conn->fn_data = NULL;
+        peer->fwd_conn->is_closing = 1;
+    }
+
+    if(peer->ws_conn != NULL)
+    {
+        peer->ws_conn->fn_data = NULL;
+        peer->ws_conn->is_closing = 1;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    mg_free(peer->name);
+    mg_free(peer->tcp_url);
+    mg_free(peer->ws_url);
+    mg_free(peer->http_url);
+
+    nyx_memory_free(peer);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void forward_frame(struct mg_peer *peer, const uint8_t *frame_buff, const size_t frame_size)
+{
+    struct mg_connection *conn = peer->fwd_conn;
+
+    if(conn == NULL || conn->send.len + frame_size > CLUSTER_FORWARD_SIZE)
+    {
+        /* The owner is unreachable or not keeping up, like a slow subscriber */
+
+        peer->forward_dropped++;
+
+        return;
+    }
+
+    mg_send(conn, frame_buff, frame_size);
+
+    peer->forwarded++;
+    peer->forwarded_bytes += frame_size;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void cluster_announce(void)
+{
+    if(mqtt_conn != NULL && CLUSTER_NODE[0] != '\0')
+    {
+        const struct mg_mqtt_opts opts = {
+            .topic = mg_str("nyx/cluster"),
+            .message = mg_str(CLUSTER_NODE),
+            .qos = 0,
+        };
+
+        mg_mqtt_pub(mqtt_conn, &opts);
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* CLIENT MANAGEMENT                                                                                                  */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void get_addr(char addr[INET6_ADDRSTRLEN], const struct mg_connection *conn)
+{
+    if(conn->rem.is_ip6) {
+        inet_ntop(AF_INET6, &conn->rem.ip, addr, INET6_ADDRSTRLEN);
+    } else {
+        inet_ntop(AF_INET, &conn->rem.ip, addr, INET6_ADDRSTRLEN);
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct mg_session *open_session(struct mg_connection *conn, const bool mux, const bool raw, const bool batch, const uint32_t batch_ms, const uint32_t fragment_size)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* CREATE SESSION                                                                                                 */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_session *session = nyx_memory_alloc(sizeof(struct mg_session));
+
+    memset(session, 0x00, sizeof(struct mg_session));
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    session->mux = mux;
+
+    session->raw = raw;
+
+    session->batch = batch;
+    session->batch_ms = batch_ms;
+    session->batch_start_ms = 0x0000LLU;
+
+    session->fragment_size = fragment_size;
+
+    session->last_send_ms = mg_millis();
+    nyx_timer_init(&session->idle_timer, idle_timer_handler, session);
+    nyx_timer_init(&session->dead_timer, dead_timer_handler, session);
+
+    session->replay = NULL;
+    nyx_timer_init(&session->replay_timer, replay_timer_handler, session);
+
+    session->conn = conn;
+    session->next = sessions;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* REGISTER SESSION                                                                                               */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    sessions = session;
+
+    /* Raw subscribers have no ping, a dead peer shows up as a socket error */
+
+    if(raw == false)
+    {
+        nyx_wheel_schedule(&wheel, &session->idle_timer, session->last_send_ms + KEEPALIVE_MS);
+    }
+
+    conn->fn_data = session;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return session;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct mg_client *find_client(const struct mg_session *session, const uint32_t hash)
+{
+    for(struct mg_client *client = clients; client != NULL; client = client->next)
+    {
+        if(client->session == session && client->hash == hash)
+        {
+            return client;
+        }
+    }
+
+    return NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static uint32_t add_client(struct mg_session *session, const struct mg_str stream, const uint32_t period_ms, uint32_t weight, uint32_t priority, uint64_t max_bps, uint32_t max_age_ms)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const uint32_t hash = nyx_hash(stream.len, stream.buf, STREAM_MAGIC);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(weight < 1U) {
+        weight = 1U;
+    }
+    if(weight > EGRESS_MAX_WEIGHT) {
+        weight = EGRESS_MAX_WEIGHT;
+    }
+
+    if(priority > EGRESS_CLASSES - 1U) {
+        priority = EGRESS_CLASSES - 1U;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    char addr[INET6_ADDRSTRLEN] = {0};
+
+    get_addr(addr, session->conn);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* UPDATE CLIENT                                                                                                  */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_client *client = find_client(session, hash);
+
+    if(client != NULL)
+    {
+        client->period_ms = period_ms;
+
+        client->max_bps = max_bps;
+
+        client->max_age_ms = max_age_ms;
+
+        update_rates(client, NULL);
+
+        MG_INFO(("Updating stream %08X (name: `%.*s`, period %u ms, weight %u, priority %u, max %llu B/s, max age %u ms, ip `%s`)", hash, (int) stream.len, (str_t) stream.buf, period_ms, weight, priority, (unsigned long long) client->rate.rate_bps, max_age_ms, addr));
+
+        client->weight = weight;
+
+        if(client->priority != priority)
+        {
+            const bool active = client->active;
+
+            if(active) {
+                deactivate_client(client);
+            }
+
+            client->priority = priority;
+
+            if(active) {
+                activate_client(client);
+            }
+        }
+
+        relay_update(hash, stream);
+
+        return hash;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* CREATE CLIENT                                                                                                  */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    client = nyx_memory_alloc(sizeof(struct mg_client));
+
+    memset(client, 0x00, sizeof(struct mg_client));
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    client->hash = hash;
+    client->name = nyx_memory_alloc(stream.len + 1U);
+    memcpy(client->name, stream.buf, stream.len);
+    client->name[stream.len] = '\0';
+
+    client->period_ms = period_ms;
+    client->last_send_ms = 0x0000LLU;
+    client->pending = NULL;
+    nyx_timer_init(&client->pacing_timer, pacing_timer_handler, client);
+
+    client->weight = weight;
+    client->priority = priority;
+
+    client->max_bps = max_bps;
+    client->ramp_ms = ADMIT > 0U && admit.storm ? mg_millis() : 0U;
+    client->max_age_ms = max_age_ms;
+    client->addr_ceiling = find_ceiling(addr_ceilings, addr_ceiling_cnt, nyx_hash(strlen(addr), addr, STREAM_MAGIC), addr);
+
+    client->session = session;
+    client->next = clients;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* REGISTER CLIENT                                                                                                */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    clients = client;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(client->addr_ceiling != NULL)
+    {
+        client->addr_ceiling->client_cnt++;
+    }
+
+    update_rates(client, client->addr_ceiling);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    MG_INFO(("Opening stream %08X (name: `%.*s`, period %u ms, weight %u, priority %u, max %llu B/s, max age %u ms, batch %s, ip `%s`)", hash, (int) stream.len, (str_t) stream.buf, period_ms, weight, priority, (unsigned long long) client->rate.rate_bps, max_age_ms, session->batch ? "on" : "off", addr));
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    relay_update(hash, stream);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return hash;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void rm_clients(const struct mg_session *session, const uint32_t hash, const bool all)
+{
+    for(struct mg_client **pp = &clients; *pp != NULL;)
+    {
+        if((*pp)->session == session && (all || (*pp)->hash == hash))
+        {
+            /*--------------------------------------------------------------------------------------------------------*/
+
+            char addr[INET6_ADDRSTRLEN] = {0};
+
+            get_addr(addr, session->conn);
+
+            MG_INFO(("Closing stream `%08X` (ip `%s`)", (*pp)->hash, addr));
+
+            /*--------------------------------------------------------------------------------------------------------*/
+
+            struct mg_client *dead = *pp; *pp = (*pp)->next;
+
+            nyx_wheel_cancel(&wheel, &dead->pacing_timer);
+
+            nyx_frame_release(dead->pending);
+
+            if(dead->active)
+            {
+                deactivate_client(dead);
+            }
+
+            nyx_fifo_clear(&dead->queue);
+
+            const uint32_t dead_hash = dead->hash;
+
+            struct mg_ceiling *dead_ceiling = dead->addr_ceiling;
+
+            nyx_memory_free(dead->name);
+
+            nyx_memory_free(dead);
+
+            /*--------------------------------------------------------------------------------------------------------*/
+
+            if(dead_ceiling != NULL)
+            {
+                dead_ceiling->client_cnt--;
+
+                update_rates(NULL, dead_ceiling);
+            }
+
+            /*--------------------------------------------------------------------------------------------------------*/
+
+            relay_update(dead_hash, mg_str_n(NULL, 0U));
+
+            /*--------------------------------------------------------------------------------------------------------*/
+        }
+        else
+        {
+            pp = &(*pp)->next;
+        }
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void close_session(const struct mg_connection *conn)
+{
+    for(struct mg_session **pp = &sessions; *pp != NULL; pp = &(*pp)->next)
+    {
+        if((*pp)->conn == conn)
+        {
+            /*--------------------------------------------------------------------------------------------------------*/
+
+            rm_clients(*pp, 0x00, true);
+
+            /*--------------------------------------------------------------------------------------------------------*/
+
+            struct mg_session *dead = *pp; *pp = (*pp)->next;
+
+            nyx_wheel_cancel(&wheel, &dead->idle_timer);
+            nyx_wheel_cancel(&wheel, &dead->dead_timer);
+            nyx_wheel_cancel(&wheel, &dead->replay_timer);
+
+            nyx_cursor_close(dead->replay);
+
+            nyx_buffer_free(&dead->batch_buf);
+
+            nyx_fifo_clear(&dead->raw_queue);
+
+            nyx_memory_free(dead);
+
+            break;
+
+            /*--------------------------------------------------------------------------------------------------------*/
+        }
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* IO_URING                                                                                                           */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void uring_handler(const uint64_t user_data, const int32_t result)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_session *session = (struct mg_session *) (uintptr_t) user_data;
+
+    struct mg_connection *conn = session->conn;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /**/ if(result > 0)
+    {
+        mg_iobuf_del(&conn->send, 0U, (size_t) result);
+
+        if(conn->send.len == 0U && session->out_armed)
+        {
+            MG_EPOLL_MOD(conn, 0);
+        }
+    }
+    else if(result == -EINVAL || result == -EOPNOTSUPP)
+    {
+        MG_ERROR(("io_uring send not supported, falling back to epoll"));
+
+        nyx_uring_disable();
+    }
+    else if(result != -EAGAIN)
+    {
+        conn->is_closing = 1;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    session->out_armed = conn->send.len > 0U;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    pump_egress(session, mg_millis(), EGRESS_WATERMARK);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void uring_wakeup_handler(struct mg_connection *conn, __NYX_UNUSED__ int event, __NYX_UNUSED__ void *event_data)
+{
+    /* An eventfd, mongoose must never read it */
+
+    conn->is_full = 1;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void flush_uring(void)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(nyx_uring_enabled() == false)
+    {
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* One submission for all the subscribers having pending data */
+
+    for(struct mg_session *session = sessions; session != NULL; session = session->next)
+    {
+        const struct mg_connection *conn = session->conn;
+
+        if(conn->send.len > 0U && conn->is_tls == false && conn->is_closing == false)
+        {
+            if(nyx_uring_send((int) (size_t) conn->fd, conn->send.buf, conn->send.len, (uint64_t) (uintptr_t) session) == false)
+            {
+                nyx_uring_submit(uring_handler);
+
+                nyx_uring_send((int) (size_t) conn->fd, conn->send.buf, conn->send.len, (uint64_t) (uintptr_t) session);
+            }
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    nyx_uring_submit(uring_handler);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* RECORDINGS                                                                                                         */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct mg_playback
+{
+    struct nyx_cursor *cursor;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool is_recorded(const uint32_t hash)
+{
+    for(size_t i = 0; i < record_cnt; i++)
+    {
+        if(record_hashes[i] == hash || record_hashes[i] == 0x00)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void close_playback(struct mg_connection *conn)
+{
+    struct mg_playback *playback = conn->fn_data;
+
+    if(playback != NULL)
+    {
+        nyx_cursor_close(playback->cursor);
+
+        nyx_memory_free(playback);
+
+        conn->fn_data = NULL;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void pump_playback(struct mg_connection *conn)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const struct mg_playback *playback = conn->fn_data;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    uint64_t time_ms;
+    size_t frame_size;
+    BUFF_t frame_buff;
+
+    while(conn->send.len < PLAYBACK_SIZE)
+    {
+        if(nyx_cursor_next(playback->cursor, &time_ms, &frame_size, &frame_buff) == false)
+        {
+            mg_http_write_chunk(conn, "", 0x00);
+
+            close_playback(conn);
+
+            break;
+        }
+
+        mg_http_write_chunk(conn, frame_buff, frame_size);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void open_playback(struct mg_connection *conn, const struct mg_http_message *hm, const struct mg_str stream)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    uint64_t from_ms;
+    uint64_t to_ms;
+
+    /**/
+    mg_query_to_uint64(hm, "from", &from_ms, 0x0000000000000000LLU);
+    mg_query_to_uint64(hm, "to", &to_ms, 0xFFFFFFFFFFFFFFFFLLU);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct nyx_cursor *cursor = nyx_cursor_open(RECORD_DIR, nyx_hash(stream.len, stream.buf, STREAM_MAGIC), from_ms, to_ms);
+
+    if(cursor == NULL)
+    {
+        mg_http_reply(conn, 404, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "No recording\n");
+
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_playback *playback = nyx_memory_alloc(sizeof(struct mg_playback));
+
+    playback->cursor = cursor;
+
+    conn->fn_data = playback;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    mg_printf(conn, "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: application/octet-stream\r\nTransfer-Encoding: chunked\r\n\r\n");
+
+    pump_playback(conn);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void open_replay(struct mg_session *session, const struct mg_http_message *hm, const struct mg_str stream)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    uint64_t from_ms;
+    uint64_t to_ms;
+
+    /**/
+    mg_query_to_uint64(hm, "from", &from_ms, 0x0000000000000000LLU);
+    mg_query_to_uint64(hm, "to", &to_ms, 0xFFFFFFFFFFFFFFFFLLU);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    session->replay = nyx_cursor_open(RECORD_DIR, nyx_hash(stream.len, stream.buf, STREAM_MAGIC), from_ms, to_ms);
+
+    if(session->replay == NULL)
+    {
+        mg_ws_printf(session->conn, WEBSOCKET_OP_TEXT, "{%m:%m}", MG_ESC("error"), MG_ESC("No recording"));
+
+        mg_ws_send(session->conn, "", 0x00, WEBSOCKET_OP_CLOSE);
+
+        session->conn->is_draining = 1;
+
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    MG_INFO(("Replaying stream `%.*s` (from %llu ms to %llu ms)", (int) stream.len, stream.buf, (unsigned long long) from_ms, (unsigned long long) to_ms));
+
+    session->replay_origin_ms = mg_millis();
+    session->replay_base_ms = 0x0000LLU;
+    session->replay_frame = NULL;
+
+    nyx_wheel_schedule(&wheel, &session->replay_timer, session->replay_origin_ms);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* INGEST                                                                                                             */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void dispatch_frame(const uint32_t stream_hash, const uint8_t *frame_buff, const size_t frame_size, struct nyx_frame *pooled)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    stats.frames_in += 1U;
+    stats.bytes_in += frame_size;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const uint64_t now = mg_millis();
+
+    /* Frames coming back from the worker pool are shared as is */
+
+    struct nyx_frame *frame = pooled != NULL ? nyx_frame_retain(pooled) : NULL;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(is_recorded(stream_hash))
+    {
+        nyx_recorder_push(stream_hash, wall_millis(), frame_size, frame_buff);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const struct mg_image *image = find_image(stream_hash);
+
+    if(image != NULL && frame_size != STREAM_HEADER_SIZE + image->size)
+    {
+        /* Not the declared shape, every subscriber gets the full frame */
+
+        stats.image_mismatched++;
+
+        image = NULL;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(struct mg_client *client = clients; client != NULL; client = client->next)
+    {
+        if(client->hash == stream_hash)
+        {
+            const uint32_t period_ms = effective_period(client, now);
+
+            if(period_ms == 0U || (now - client->last_send_ms) >= (uint64_t) period_ms)
+            {
+                struct nyx_frame **client_frame = &frame;
+                const uint8_t *client_buff = frame_buff;
+                size_t client_size = frame_size;
+
+                /* Views are only computed for the subscribers actually sent this frame */
+
+                if(image != NULL && client->view.bin > 0U)
+                {
+                    client_frame = view_frame(image, &client->view, frame_buff, pooled != NULL ? pooled->ingest_ms : now);
+
+                    client_buff = (*client_frame)->data;
+                    client_size = (*client_frame)->size;
+
+                    stats.image_served++;
+                }
+
+                send_frame(client, client_frame, client_buff, client_size, now);
+
+                client->last_send_ms = now;
+
+                /* Supersedes any paced frame */
+
+                nyx_wheel_cancel(&wheel, &client->pacing_timer);
+
+                nyx_frame_release(client->pending);
+
+                client->pending = NULL;
+            }
+            else
+            {
+                /* Too early, keep the latest frame until the period elapses, one copy shared by all the subscribers */
+
+                if(period_ms != client->period_ms && (now - client->last_send_ms) >= (uint64_t) client->period_ms)
+                {
+                    if(shed.level >= 1U) {
+                        stats.shed_paced++;
+                    }
+                    else {
+                        stats.admit_paced++;
+                    }
+                }
+
+                if(frame == NULL)
+                {
+                    struct nyx_frame *pending = client->pending;
+
+                    if(pending != NULL && pending->refs == 1U && pending->size == frame_size)
+                    {
+                        /* Nobody else holds the previous one, its buffer is reused */
+
+                        memcpy(pending->data, frame_buff, frame_size);
+
+                        pending->ingest_ms = now;
+
+                        frame = nyx_frame_retain(pending);
+                    }
+                    else
+                    {
+                        frame = nyx_frame_new(stream_hash, now, frame_size, frame_buff);
+                    }
+                }
+
+                nyx_frame_release(client->pending);
+
+                client->pending = nyx_frame_retain(frame);
+
+                if(nyx_timer_pending(&client->pacing_timer) == false)
+                {
+                    nyx_wheel_schedule(&wheel, &client->pacing_timer, client->last_send_ms + period_ms);
+                }
+            }
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    nyx_frame_release(frame);
+
+    release_views();
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t parse_frames(const uint8_t *buff, const size_t size, struct mg_producer *producer)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    size_t off = 0U;
+
+    while(size - off >= STREAM_HEADER_SIZE)
+    {
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        const uint8_t *frame_buff = buff + off;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        const uint32_t header_magic = nyx_read_u32_le(frame_buff + 0);
+        const uint32_t stream_hash  = nyx_read_u32_le(frame_buff + 4);
+        const uint32_t stream_size  = nyx_read_u32_le(frame_buff + 8);
+
+        if(header_magic != STREAM_MAGIC)
+        {
+            off += 1U;
+
+            continue;
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        const size_t frame_size = STREAM_HEADER_SIZE + (size_t) stream_size;
+
+        if(size - off < frame_size)
+        {
+            /* Incomplete frame, wait... */
+
+            break;
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        if(producer != NULL)
+        {
+            if(producer->budget_bytes == 0U || producer->budget_frames == 0U)
+            {
+                /* Budget spent, the other producers go first */
+
+                producer->deferred = true;
+
+                break;
+            }
+
+            /* A frame larger than the budget still goes through, alone */
+
+            producer->budget_bytes = producer->budget_bytes > frame_size ? producer->budget_bytes - frame_size : 0U;
+            producer->budget_frames--;
+
+            producer->frames++;
+            producer->bytes += frame_size;
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        struct mg_peer *owner;
+
+        /**/ if(stream_size == 0U)
+        {
+            /* A peer forwarding frames to their owner says so first, they must not bounce back */
+
+            if(producer != NULL && stream_hash == CLUSTER_HELLO)
+            {
+                producer->peer = true;
+            }
+        }
+        else if(producer != NULL && producer->peer == false && (owner = nyx_ring_lookup(&ring, stream_hash)) != NULL)
+        {
+            forward_frame(owner, frame_buff, frame_size);
+        }
+        else if(nyx_pool_enabled())
+        {
+            nyx_pool_push(nyx_frame_new(stream_hash, mg_millis(), frame_size, frame_buff));
+        }
+        else
+        {
+            dispatch_frame(stream_hash, frame_buff, frame_size, NULL);
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        off += frame_size;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return off;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void pool_handler(struct nyx_frame *frame)
+{
+    dispatch_frame(frame->hash, frame->data, frame->size, frame);
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void pool_wakeup(void *arg)
+{
+    /* Called from the workers, mongoose's wakeup pipe is the only thread-safe entry point */
+
+    struct mg_mgr *mgr = arg;
+
+    mg_wakeup(mgr, wakeup_id, NULL, 0U);
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct nyx_frame *dedup_stage(struct nyx_frame *frame, __NYX_UNUSED__ void *arg)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    static uint64_t slots[DEDUP_SLOTS];
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* A stream always runs on the same worker, colliding streams merely miss a duplicate */
+
+    const uint32_t digest = nyx_hash(frame->size - STREAM_HEADER_SIZE, frame->data + STREAM_HEADER_SIZE, STREAM_MAGIC);
+
+    const uint64_t entry = ((uint64_t) frame->hash << 32) | digest;
+
+    if(__atomic_exchange_n(&slots[frame->hash % DEDUP_SLOTS], entry, __ATOMIC_RELAXED) == entry)
+    {
+        nyx_frame_release(frame);
+
+        return NULL;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return frame;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void open_producer(struct mg_connection *conn)
+{
+    struct mg_producer *producer = nyx_memory_alloc(sizeof(struct mg_producer));
+
+    memset(producer, 0x00, sizeof(struct mg_producer));
+
+    producer->conn = conn;
+    producer->next = producers;
+
+    producers = producer;
+
+    conn->fn_data = producer;
+
+    /* Read through the ring from now on, mongoose no longer polls the socket */
+
+    if(ingest_uring && nyx_uring_recv((int) (size_t) conn->fd, conn->id))
+    {
+        epoll_ctl(conn->mgr->epoll_fd, EPOLL_CTL_DEL, (int) (size_t) conn->fd, NULL);
+
+        producer->uring = true;
+        producer->armed = true;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void close_producer(const struct mg_connection *conn)
+{
+    for(struct mg_producer **pp = &producers; *pp != NULL; pp = &(*pp)->next)
+    {
+        if((*pp)->conn == conn)
+        {
+            struct mg_producer *dead = *pp; *pp = (*pp)->next;
+
+            if(dead->deferred)
+            {
+                ingest_deferred--;
+            }
+
+            /* The ring holds a reference on the socket as long as the receive is armed */
+
+            if(dead->armed)
+            {
+                nyx_uring_recv_cancel(conn->id);
+            }
+
+            MG_INFO(("%lu TCP producer done (frames: %llu, bytes: %llu, deferrals: %llu, throttles: %llu)", conn->id, (unsigned long long) dead->frames, (unsigned long long) dead->bytes, (unsigned long long) dead->deferrals, (unsigned long long) dead->throttles));
+
+            nyx_memory_free(dead);
+
+            break;
+        }
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void ingest_append(struct mg_connection *conn, BUFF_t buff, size_t size)
+{
+    struct mg_iobuf *iobuf = &conn->recv;
+
+    /* mg_iobuf_add() reallocates to the exact size on every call, the buffer is doubled instead */
+
+    if(iobuf->size - iobuf->len < size && mg_iobuf_resize(iobuf, 2U * (iobuf->len + size)) == 0)
+    {
+        mg_error(conn, "OOM");
+
+        return;
+    }
+
+    memcpy(iobuf->buf + iobuf->len, buff, size);
+
+    iobuf->len += size;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t ingest_straddle(const struct mg_iobuf *iobuf, BUFF_t buff, size_t size)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* How many bytes complete the frame pending in the receive buffer */
+
+    if(iobuf->len + size < STREAM_HEADER_SIZE)
+    {
+        return size;
+    }
+
+    uint8_t header[STREAM_HEADER_SIZE];
+
+    if(iobuf->len >= STREAM_HEADER_SIZE)
+    {
+        memcpy(header, iobuf->buf, STREAM_HEADER_SIZE);
+    }
+    else
+    {
+        memcpy(header, iobuf->buf, iobuf->len);
+        memcpy(header + iobuf->len, buff, STREAM_HEADER_SIZE - iobuf->len);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(nyx_read_u32_le(header + 0) != STREAM_MAGIC)
+    {
+        /* Resynchronized by parse_frames(), byte per byte */
+
+        return size;
+    }
+
+    const size_t frame_size = STREAM_HEADER_SIZE + (size_t) nyx_read_u32_le(header + 8);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return frame_size <= iobuf->len ? 0U : frame_size - iobuf->len < size ? frame_size - iobuf->len : size;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void ingest(struct mg_producer *producer, __NYX_NULLABLE__ BUFF_t buff, __NYX_ZEROABLE__ size_t size)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_connection *conn = producer->conn;
+
+    struct mg_iobuf *iobuf = &conn->recv;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Fresh budget once per loop iteration, shared by the poll and the read events */
+
+    if(producer->round != ingest_round)
+    {
+        producer->round = ingest_round;
+        producer->budget_bytes = INGEST_BUDGET_BYTES;
+        producer->budget_frames = INGEST_BUDGET_FRAMES;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const bool was_deferred = producer->deferred;
+
+    producer->deferred = false;
+
+    size_t off = 0U;
+
+    /* Bytes from the ring are parsed in place, only the frames straddling two buffers are copied */
+
+    if(iobuf->len > 0U && size > 0U)
+    {
+        const size_t head = was_deferred ? size : ingest_straddle(iobuf, buff, size);
+
+        ingest_append(conn, buff, head);
+
+        buff = (const uint8_t *) buff + head;
+
+        size -= head;
+    }
+
+    if(iobuf->len > 0U || buff == NULL)
+    {
+        off = parse_frames((const uint8_t *) iobuf->buf, iobuf->len, producer);
+
+        if(off > 0U)
+        {
+            mg_iobuf_del(iobuf, 0U, off);
+        }
+
+        /* Deferred, what is left goes after it */
+
+        if(iobuf->len > 0U && size > 0U)
+        {
+            ingest_append(conn, buff, size);
+
+            size = 0U;
+        }
+    }
+
+    if(size > 0U)
+    {
+        const size_t n = parse_frames((const uint8_t *) buff, size, producer);
+
+        if(n < size)
+        {
+            ingest_append(conn, (const uint8_t *) buff + n, size - n);
+        }
+
+        off += n;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(producer->deferred != was_deferred)
+    {
+        if(producer->deferred) {
+            ingest_deferred++;
+        }
+        else {
+            ingest_deferred--;
+        }
+    }
+
+    if(producer->deferred && off > 0U)
+    {
+        producer->deferrals++;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Only with complete frames pending, so that a large frame can still be read in full */
+
+    const bool full = producer->deferred && iobuf->len >= INGEST_READAHEAD;
+
+    if(full && conn->is_full == false)
+    {
+        producer->throttles++;
+    }
+
+    conn->is_full = full;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void release_producer(struct mg_producer *producer)
+{
+    MG_EPOLL_ADD(producer->conn);
+
+    producer->uring = false;
+    producer->armed = false;
+    producer->parked = false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void release_producers(void)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Bytes already received are reaped with the cancellations, the others stay in the sockets */
+
+    for(struct mg_producer *producer = producers; producer != NULL; producer = producer->next)
+    {
+        if(producer->armed)
+        {
+            nyx_uring_recv_cancel(producer->conn->id);
+        }
+    }
+
+    nyx_uring_submit(uring_handler);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(struct mg_producer *producer = producers; producer != NULL; producer = producer->next)
+    {
+        if(producer->uring)
+        {
+            release_producer(producer);
+        }
+    }
+
+    ingest_uring = false;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void ingest_ring_handler(const uint64_t user_data, BUFF_t buff, const int32_t result, const bool more)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_producer *producer = producers;
+
+    while(producer != NULL && producer->conn->id != user_data)
+    {
+        producer = producer->next;
+    }
+
+    if(producer == NULL)
+    {
+        /* Closed in the meantime */
+
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_connection *conn = producer->conn;
+
+    if(more == false)
+    {
+        producer->armed = false;
+        producer->parked = false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /**/ if(result > 0)
+    {
+        ingest(producer, buff, (size_t) result);
+
+        /* Throttled, the bytes stay in the socket until the frames pending are dispatched */
+
+        if(conn->is_full && producer->armed && producer->parked == false)
+        {
+            producer->parked = nyx_uring_recv_cancel(conn->id);
+        }
+    }
+    else if(result == 0)
+    {
+        conn->is_closing = 1;
+    }
+    else if(result == -EINVAL || result == -EOPNOTSUPP)
+    {
+        MG_ERROR(("io_uring multishot receive not supported, falling back to epoll"));
+
+        ingest_uring = false;
+
+        release_producer(producer);
+    }
+    else if(result != -ENOBUFS && result != -ECANCELED)
+    {
+        conn->is_closing = 1;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void ingest_ring_rearm(struct mg_producer *producer)
+{
+    struct mg_connection *conn = producer->conn;
+
+    /**/ if(nyx_uring_recv_enabled() == false)
+    {
+        /* The ring was torn down, the receives with it */
+
+        release_producer(producer);
+    }
+    else if(producer->armed == false && conn->is_full == false && conn->is_closing == false)
+    {
+        /* Out of buffers, or no longer throttled */
+
+        producer->armed = nyx_uring_recv((int) (size_t) conn->fd, conn->id);
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void tcp_handler(struct mg_connection *conn, int event, __NYX_UNUSED__ void *event_data)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /**/ if(event == MG_EV_OPEN)
+    {
+        MG_INFO(("%lu TCP OPEN", conn->id));
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(event == MG_EV_ACCEPT)
+    {
+        open_producer(conn);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(event == MG_EV_CLOSE)
+    {
+        MG_INFO(("%lu TCP CLOSE", conn->id));
+
+        close_producer(conn);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(event == MG_EV_READ || event == MG_EV_POLL)
+    {
+        struct mg_producer *producer = conn->fn_data;
+
+        if(producer != NULL)
+        {
+            if(event == MG_EV_READ || producer->deferred)
+            {
+                ingest(producer, NULL, 0U);
+            }
+
+            if(producer->uring)
+            {
+                ingest_ring_rearm(producer);
+            }
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* MULTIPLEXING                                                                                                       */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void mux_handler(struct mg_session *session, const struct mg_str json)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Raw subscribers only ever receive frames: no acknowledgement, disconnected on error */
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    str_t subscribe = mg_json_get_str(json, "$.subscribe");
+    str_t unsubscribe = mg_json_get_str(json, "$.unsubscribe");
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* SUBSCRIBE                                                                                                      */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const bool is_new = subscribe != NULL && subscribe[0] != '\0' && find_client(session, nyx_hash(strlen(subscribe), subscribe, STREAM_MAGIC)) == NULL;
+
+    /**/ if(is_new && shed.level >= 3U)
+    {
+        stats.shed_rejected++;
+
+        if(session->raw) {
+            session->conn->is_closing = 1;
+        }
+        else {
+            mg_ws_printf(session->conn, WEBSOCKET_OP_TEXT, "{%m:%m,%m:%u}", MG_ESC("error"), MG_ESC("Overloaded"), MG_ESC("retry_after"), retry_after(SHED_RETRY_S));
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(is_new && admit_subscriber(mg_millis()) == false)
+    {
+        if(session->raw) {
+            session->conn->is_closing = 1;
+        }
+        else {
+            mg_ws_printf(session->conn, WEBSOCKET_OP_TEXT, "{%m:%m,%m:%u}", MG_ESC("error"), MG_ESC("Too many subscriptions"), MG_ESC("retry_after"), retry_after(ADMIT_RETRY_S));
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(subscribe != NULL && subscribe[0] != '\0')
+    {
+        const long period_ms = mg_json_get_long(json, "$.period", 0L);
+        const long weight = mg_json_get_long(json, "$.weight", 1L);
+        const long priority = mg_json_get_long(json, "$.priority", EGRESS_DEFAULT_PRIORITY);
+        const long max_bps = mg_json_get_long(json, "$.max_bps", 0L);
+        const long bin = mg_json_get_long(json, "$.bin", 0L);
+        const long max_age_ms = mg_json_get_long(json, "$.max_age_ms", 0L);
+
+        str_t roi = mg_json_get_str(json, "$.roi");
+
+        const uint32_t hash = add_client(
+            session,
+            mg_str(subscribe),
+            period_ms > 0L ? (uint32_t) period_ms : 0U,
+            weight > 0L ? (uint32_t) weight : 1U,
+            priority > 0L ? (uint32_t) priority : 0U,
+            max_bps > 0L ? (uint64_t) max_bps : 0U,
+            max_age_ms > 0L ? (uint32_t) max_age_ms : 0U
+        );
+
+        struct mg_client *client = find_client(session, hash);
+
+        const struct mg_view view = parse_view(mg_str(roi), bin > 0L ? (uint32_t) bin : 0U);
+
+        set_view(client, &view);
+
+        if(session->raw == false)
+        {
+            if(client->view.bin > 0U)
+            {
+                /* The effective view, the ROI may have been clipped and trimmed to whole bins */
+
+                mg_ws_printf(session->conn, WEBSOCKET_OP_TEXT, "{%m:%m,%m:\"%08X\",%m:%ld,%m:%llu,%m:%u,%m:\"%u,%u,%u,%u\",%m:%u,%m:%u,%m:%u}", MG_ESC("subscribed"), MG_ESC(subscribe), MG_ESC("hash"), hash, MG_ESC("period"), period_ms > 0L ? period_ms : 0L, MG_ESC("max_bps"), (unsigned long long) client->rate.rate_bps, MG_ESC("max_age_ms"), client->max_age_ms, MG_ESC("roi"), client->view.x, client->view.y, client->view.w, client->view.h, MG_ESC("bin"), client->view.bin, MG_ESC("width"), client->view.w / client->view.bin, MG_ESC("height"), client->view.h / client->view.bin);
+            }
+            else
+            {
+                mg_ws_printf(session->conn, WEBSOCKET_OP_TEXT, "{%m:%m,%m:\"%08X\",%m:%ld,%m:%llu,%m:%u}", MG_ESC("subscribed"), MG_ESC(subscribe), MG_ESC("hash"), hash, MG_ESC("period"), period_ms > 0L ? period_ms : 0L, MG_ESC("max_bps"), (unsigned long long) client->rate.rate_bps, MG_ESC("max_age_ms"), client->max_age_ms);
+            }
+        }
+
+        free(roi);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* UNSUBSCRIBE                                                                                                    */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(unsubscribe != NULL && unsubscribe[0] != '\0')
+    {
+        const uint32_t hash = nyx_hash(strlen(unsubscribe), unsubscribe, STREAM_MAGIC);
+
+        rm_clients(session, hash, false);
+
+        if(session->raw == false)
+        {
+            mg_ws_printf(session->conn, WEBSOCKET_OP_TEXT, "{%m:%m,%m:\"%08X\"}", MG_ESC("unsubscribed"), MG_ESC(unsubscribe), MG_ESC("hash"), hash);
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* ERROR                                                                                                          */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else
+    {
+        if(session->raw) {
+            session->conn->is_closing = 1;
+        }
+        else {
+            mg_ws_printf(session->conn, WEBSOCKET_OP_TEXT, "{%m:%m}", MG_ESC("error"), MG_ESC("Invalid control message"));
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    free(unsubscribe);
+    free(subscribe);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool raw_authorized(const struct mg_str json)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(TOKEN[0] == '\0')
+    {
+        return true;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    str_t token = mg_json_get_str(json, "$.token");
+
+    const bool result = token != NULL && strlen(token) == 16 && memcmp(token, TOKEN, 16) == 0;
+
+    free(token);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void sub_handler(struct mg_connection *conn, int event, __NYX_UNUSED__ void *event_data)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /**/ if(event == MG_EV_ACCEPT)
+    {
+        MG_INFO(("%lu SUB OPEN", conn->id));
+
+        open_session(conn, true, true, false, 0U, 0U);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(event == MG_EV_CLOSE)
+    {
+        if(conn->fn_data != NULL)
+        {
+            MG_INFO(("%lu SUB CLOSE", conn->id));
+
+            close_session(conn);
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(event == MG_EV_READ)
+    {
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        struct mg_iobuf *iobuf = &conn->recv;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        /* One control message per line, same JSON as over a multiplexed WebSocket */
+
+        size_t off = 0U;
+
+        for(const uint8_t *eol; conn->is_closing == false && (eol = memchr(iobuf->buf + off, '\n', iobuf->len - off)) != NULL;)
+        {
+            const struct mg_str json = mg_str_n((str_t) iobuf->buf + off, (size_t) (eol - iobuf->buf) - off);
+
+            if(json.len > 0U)
+            {
+                if(raw_authorized(json)) {
+                    mux_handler(conn->fn_data, json);
+                }
+                else {
+                    conn->is_closing = 1;
+                }
+            }
+
+            off = (size_t) (eol - iobuf->buf) + 1U;
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        if(off > 0U)
+        {
+            mg_iobuf_del(iobuf, 0U, off);
+        }
+
+        if(iobuf->len > RAW_REQUEST_SIZE)
+        {
+            MG_ERROR(("%lu SUB request too large", conn->id));
+
+            conn->is_closing = 1;
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(event == MG_EV_POLL || event == MG_EV_WRITE)
+    {
+        if(conn->fn_data != NULL)
+        {
+            if(event == MG_EV_WRITE)
+            {
+                stats.writes++;
+            }
+
+            pump_egress(conn->fn_data, mg_millis(), EGRESS_WATERMARK);
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t print_producers(mg_pfn_t out, void *arg, __NYX_UNUSED__ va_list *ap)
+{
+    size_t result = 0U;
+
+    for(const struct mg_producer *producer = producers; producer != NULL; producer = producer->next)
+    {
+        result += mg_xprintf(out, arg, "%s{%m:%lu,%m:\"%M\",%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:%lu,%m:%s}",
+            result > 0U ? "," : "",
+            MG_ESC("id"), producer->conn->id,
+            MG_ESC("ip"), mg_print_ip_port, &producer->conn->rem,
+            MG_ESC("frames"), (unsigned long long) producer->frames,
+            MG_ESC("bytes"), (unsigned long long) producer->bytes,
+            MG_ESC("deferrals"), (unsigned long long) producer->deferrals,
+            MG_ESC("throttles"), (unsigned long long) producer->throttles,
+            MG_ESC("backlog"), (unsigned long) producer->conn->recv.len,
+            MG_ESC("throttled"), producer->conn->is_full ? "true" : "false"
+        );
+    }
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t print_images(mg_pfn_t out, void *arg, __NYX_UNUSED__ va_list *ap)
+{
+    static STR_t types[] = {"u8", "u16", "u32", "f32"};
+
+    size_t result = 0U;
+
+    for(size_t i = 0U; i < image_cnt; i++)
+    {
+        size_t subscriptions = 0U;
+
+        for(const struct mg_client *client = clients; client != NULL; client = client->next)
+        {
+            if(client->hash == images[i].hash && client->view.bin > 0U)
+            {
+                subscriptions++;
+            }
+        }
+
+        result += mg_xprintf(out, arg, "%s{%m:%m,%m:%u,%m:%u,%m:%m,%m:%lu}",
+            result > 0U ? "," : "",
+            MG_ESC("stream"), MG_ESC(images[i].key),
+            MG_ESC("width"), images[i].width,
+            MG_ESC("height"), images[i].height,
+            MG_ESC("type"), MG_ESC(types[images[i].type]),
+            MG_ESC("views"), (unsigned long) subscriptions
+        );
+    }
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t print_hist(mg_pfn_t out, void *arg, va_list *ap)
+{
+    const uint64_t *hist = va_arg(*ap, const uint64_t *);
+
+    size_t result = 0U;
+
+    for(uint32_t i = 0U; i < DELAY_BUCKETS; i++)
+    {
+        result += mg_xprintf(out, arg, i > 0U ? ",%llu" : "%llu", (unsigned long long) hist[i]);
+    }
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t print_freshness(mg_pfn_t out, void *arg, __NYX_UNUSED__ va_list *ap)
+{
+    /* Bucket i counts ages in [2^(i-1), 2^i) ms, as the queue delay histogram */
+
+    size_t result = 0U;
+
+    for(const struct mg_client *client = clients; client != NULL; client = client->next)
+    {
+        result += mg_xprintf(out, arg, "%s{%m:%lu,%m:%m,%m:%u,%m:%llu,%m:[%M],%m:[%M]}",
+            result > 0U ? "," : "",
+            MG_ESC("id"), client->session->conn->id,
+            MG_ESC("stream"), MG_ESC(client->name),
+            MG_ESC("max_age_ms"), client->max_age_ms,
+            MG_ESC("expired"), (unsigned long long) client->expired,
+            MG_ESC("delivered_age"), print_hist, client->age_hist,
+            MG_ESC("expired_age"), print_hist, client->expired_hist
+        );
+    }
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t print_rates(mg_pfn_t out, void *arg, __NYX_UNUSED__ va_list *ap)
+{
+    size_t result = 0U;
+
+    for(const struct mg_client *client = clients; client != NULL; client = client->next)
+    {
+        result += mg_xprintf(out, arg, "%s{%m:%lu,%m:%m,%m:\"%M\",%m:%llu,%m:%llu,%m:%llu}",
+            result > 0U ? "," : "",
+            MG_ESC("id"), client->session->conn->id,
+            MG_ESC("stream"), MG_ESC(client->name),
+            MG_ESC("ip"), mg_print_ip, &client->session->conn->rem,
+            MG_ESC("max_bps"), (unsigned long long) client->rate.rate_bps,
+            MG_ESC("bps"), (unsigned long long) client->rate.bps,
+            MG_ESC("skipped"), (unsigned long long) client->rate.skipped
+        );
+    }
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t print_addr_rates(mg_pfn_t out, void *arg, __NYX_UNUSED__ va_list *ap)
+{
+    size_t result = 0U;
+
+    for(size_t i = 0U; i < addr_ceiling_cnt; i++)
+    {
+        const struct mg_ceiling *ceiling = &addr_ceilings[i];
+
+        result += mg_xprintf(out, arg, "%s{%m:%m,%m:%llu,%m:%llu,%m:%lu}",
+            i > 0U ? "," : "",
+            MG_ESC("ip"), MG_ESC(ceiling->key),
+            MG_ESC("max_bps"), (unsigned long long) ceiling->rate_bps,
+            MG_ESC("bps"), (unsigned long long) ceiling->bps,
+            MG_ESC("subscriptions"), (unsigned long) ceiling->client_cnt
+        );
+    }
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t print_peers(mg_pfn_t out, void *arg, __NYX_UNUSED__ va_list *ap)
+{
+    size_t result = 0U;
+
+    for(const struct mg_peer *peer = peers; peer != NULL; peer = peer->next)
+    {
+        result += mg_xprintf(out, arg, "%s{%m:%m,%m:%s,%m:%s,%m:%s,%m:%llu,%m:%llu,%m:%llu}",
+            peer != peers ? "," : "",
+            MG_ESC("node"), MG_ESC(peer->name),
+            MG_ESC("static"), peer->is_static ? "true" : "false",
+            MG_ESC("forwarding"), peer->fwd_conn != NULL && peer->fwd_conn->is_connecting == false ? "true" : "false",
+            MG_ESC("relaying"), peer->ws_ready ? "true" : "false",
+            MG_ESC("forwarded"), (unsigned long long) peer->forwarded,
+            MG_ESC("forwarded_bytes"), (unsigned long long) peer->forwarded_bytes,
+            MG_ESC("forward_dropped"), (unsigned long long) peer->forward_dropped
+        );
+    }
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void http_handler(struct mg_connection *conn, int event, void *event_data)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* MG_EV_HTTP_MSG                                                                                                 */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /**/ if(event == MG_EV_HTTP_MSG)
+    {
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        struct mg_http_message *hm = event_data;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* AUTHENTICATION                                                                                             */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        if(TOKEN[0] != '\0')
+        {
+            char token_buf[32];
+
+            const int token_len = mg_http_get_var(
+                &hm->query,
+                "token",
+                /*--*/(token_buf),
+                sizeof(token_buf)
+            );
+
+            if(token_len != 16 || memcmp(token_buf, TOKEN, 16) != 0)
+            {
+                mg_http_reply(conn, 403, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "Unauthorized\n");
+
+                return;
+            }
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* ROUTE /streams/<device>/<stream>                                                                           */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        struct mg_str caps[2];
+
+        /**/ if(mg_match(hm->uri, mg_str("/streams/*/*"), caps) && caps[0].len > 0 && caps[1].len > 0)
+        {
+            if(shed.level >= 3U)
+            {
+                shed_reject(conn, SHED_RETRY_S);
+
+                stats.shed_rejected++;
+            }
+            else if(mg_strcasecmp(hm->method, mg_str("GET")) == 0)
+            {
+                const struct mg_str stream = mg_str_n(hm->uri.buf + 9, hm->uri.len - 9);
+
+                const struct mg_peer *owner = nyx_ring_lookup(&ring, nyx_hash(stream.len, stream.buf, STREAM_MAGIC));
+
+                if(owner != NULL && mg_http_get_header(hm, "Upgrade") == NULL)
+                {
+                    /* WebSocket viewers are served through the relay, plain HTTP clients go to the owner */
+
+                    char *headers = mg_mprintf("Access-Control-Allow-Origin: *\r\nLocation: %s%.*s%s%.*s\r\nContent-Type: text/plain\r\n", owner->http_url, (int) hm->uri.len, hm->uri.buf, hm->query.len > 0 ? "?" : "", (int) hm->query.len, hm->query.buf);
+
+                    mg_http_reply(conn, 307, headers, "Owned by `%s`\n", owner->name);
+
+                    mg_free(headers);
+
+                    stats.cluster_redirects++;
+                }
+                else if(admit_subscriber(mg_millis()) == false)
+                {
+                    shed_reject(conn, ADMIT_RETRY_S);
+                }
+                else
+                {
+                    mg_ws_upgrade(conn, hm, NULL);
+                }
+            }
+            else
+            {
+                mg_http_reply(conn, 405, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "Method not allowed\n");
+            }
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* ROUTE /streams                                                                                             */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        else if(mg_match(hm->uri, mg_str("/streams"), NULL))
+        {
+            if(shed.level >= 3U)
+            {
+                shed_reject(conn, SHED_RETRY_S);
+
+                stats.shed_rejected++;
+            }
+            else if(mg_strcasecmp(hm->method, mg_str("GET")) == 0)
+            {
+                if(admit_subscriber(mg_millis()) == false) {
+                    shed_reject(conn, ADMIT_RETRY_S);
+                }
+                else {
+                    mg_ws_upgrade(conn, hm, NULL);
+                }
+            }
+            else
+            {
+                mg_http_reply(conn, 405, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "Method not allowed\n");
+            }
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* ROUTE /recordings/<device>/<stream>                                                                        */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        else if(mg_match(hm->uri, mg_str("/recordings/*/*"), caps) && caps[0].len > 0 && caps[1].len > 0)
+        {
+            if(mg_strcasecmp(hm->method, mg_str("GET")) == 0)
+            {
+                open_playback(conn, hm, mg_str_n(hm->uri.buf + 12, hm->uri.len - 12));
+            }
+            else
+            {
+                mg_http_reply(conn, 405, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "Method not allowed\n");
+            }
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* ROUTE /stats                                                                                               */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        else if(mg_match(hm->uri, mg_str("/stats"), NULL))
+        {
+            uint64_t uring_enters;
+            uint64_t uring_sends;
+            uint64_t uring_recvs, uring_recv_bytes, uring_nobufs;
+            uint64_t zc_sends, zc_bytes, zc_copied, zc_pinned;
+            uint64_t egress_bytes = 0U;
+
+            uint64_t egress_bps = 0U;
+
+            size_t ramping = 0U;
+
+            const uint64_t now = mg_millis();
+
+            for(const struct mg_client *client = clients; client != NULL; client = client->next)
+            {
+                egress_bytes += client->queue.bytes;
+
+                egress_bps += client->rate.bps;
+
+                if(client->ramp_ms > 0U && now - client->ramp_ms < ADMIT_RAMP_MS)
+                {
+                    ramping++;
+                }
+            }
+
+            /* Bucket i counts delays in [2^(i-1), 2^i) ms, the last one is open-ended */
+
+            char delay_hist[DELAY_BUCKETS * 21U] = {0};
+
+            for(uint32_t i = 0U, n = 0U; i < DELAY_BUCKETS; i++)
+            {
+                n += (uint32_t) mg_snprintf(delay_hist + n, sizeof(delay_hist) - n, i > 0U ? ",%llu" : "%llu", (unsigned long long) stats.delay_hist[i]);
+            }
+
+            nyx_uring_stats(&uring_enters, &uring_sends);
+
+            nyx_uring_recv_stats(&uring_recvs, &uring_recv_bytes, &uring_nobufs);
+
+            nyx_uring_zc_stats(&zc_sends, &zc_bytes, &zc_copied, &zc_pinned);
+
+            char pool_stages[NYX_POOL_MAX_STAGES * 192U] = {0};
+
+            for(size_t i = 0U, n = 0U; i < nyx_pool_stages(); i++)
+            {
+                STR_t name;
+                size_t depth, limit;
+                uint64_t processed, filtered, dropped, avg_us, max_us;
+
+                nyx_pool_stats(i, &name, &depth, &limit, &processed, &filtered, &dropped, &avg_us, &max_us);
+
+                n += mg_snprintf(pool_stages + n, sizeof(pool_stages) - n, "%s{%m:%m,%m:%lu,%m:%lu,%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:%llu}",
+                    i > 0U ? "," : "",
+                    MG_ESC("name"), MG_ESC(name),
+                    MG_ESC("depth"), (unsigned long) depth,
+                    MG_ESC("limit"), (unsigned long) limit,
+                    MG_ESC("processed"), (unsigned long long) processed,
+                    MG_ESC("filtered"), (unsigned long long) filtered,
+                    MG_ESC("dropped"), (unsigned long long) dropped,
+                    MG_ESC("avg_us"), (unsigned long long) avg_us,
+                    MG_ESC("max_us"), (unsigned long long) max_us
+                );
+            }
+
+            mg_http_reply(conn, 200, "Access-Control-Allow-Origin: *\r\nContent-Type: application/json\r\n",
+                "{%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:%llu,"
+                "%m:{%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:{%m:%llu,%m:%llu,%m:%llu,%m:[%s]}},"
+                "%m:{%m:%llu,%m:%llu},"
+                "%m:{%m:%lu,%m:[%M]},"
+                "%m:{%m:%llu,%m:%llu,%m:[%M],%m:[%M]},"
+                "%m:%llu,"
+                "%m:{%m:%s,%m:%s,%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:%llu},"
+                "%m:{%m:%u,%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:%llu},"
+                "%m:{%m:%llu,%m:%llu},"
+                "%m:{%m:%u,%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:%llu},"
+                "%m:{%m:%u,%m:%u,%m:%llu,%m:%llu,%m:%llu,%m:%lu,%m:{%m:%s,%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:%llu}},"
+                "%m:{%m:%lu,%m:[%s]},"
+                "%m:{%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:%llu,%m:[%M]},"
+                "%m:{%m:%llu,%m:[%M]}}\n",
+                MG_ESC("frames_in"), (unsigned long long) stats.frames_in,
+                MG_ESC("bytes_in"), (unsigned long long) stats.bytes_in,
+                MG_ESC("frames_out"), (unsigned long long) stats.frames_out,
+                MG_ESC("bytes_out"), (unsigned long long) stats.bytes_out,
+                MG_ESC("writes"), (unsigned long long) stats.writes,
+                MG_ESC("egress"),
+                MG_ESC("queued"), (unsigned long long) stats.egress_queued,
+                MG_ESC("dropped"), (unsigned long long) stats.egress_dropped,
+                MG_ESC("backlog"), (unsigned long long) egress_bytes,
+                MG_ESC("fragments"), (unsigned long long) stats.fragments_out,
+                MG_ESC("queue_delay_ms"),
+                MG_ESC("count"), (unsigned long long) stats.delay_cnt,
+                MG_ESC("avg"), (unsigned long long) (stats.delay_cnt > 0U ? stats.delay_sum_ms / stats.delay_cnt : 0U),
+                MG_ESC("max"), (unsigned long long) stats.delay_max_ms,
+                MG_ESC("histogram"), delay_hist,
+                MG_ESC("raw"),
+                MG_ESC("writes"), (unsigned long long) stats.raw_writes,
+                MG_ESC("frames"), (unsigned long long) stats.raw_frames,
+                MG_ESC("ingest"),
+                MG_ESC("deferred"), (unsigned long) ingest_deferred,
+                MG_ESC("producers"), print_producers,
+                MG_ESC("rate"),
+                MG_ESC("bps"), (unsigned long long) egress_bps,
+                MG_ESC("skipped"), (unsigned long long) stats.rate_skipped,
+                MG_ESC("subscriptions"), print_rates,
+                MG_ESC("addresses"), print_addr_rates,
+                MG_ESC("record_dropped"), (unsigned long long) nyx_recorder_dropped(),
+                MG_ESC("io_uring"),
+                MG_ESC("enabled"), nyx_uring_enabled() ? "true" : "false",
+                MG_ESC("ingest"), ingest_uring ? "true" : "false",
+                MG_ESC("enters"), (unsigned long long) uring_enters,
+                MG_ESC("sends"), (unsigned long long) uring_sends,
+                MG_ESC("recvs"), (unsigned long long) uring_recvs,
+                MG_ESC("recv_bytes"), (unsigned long long) uring_recv_bytes,
+                MG_ESC("nobufs"), (unsigned long long) uring_nobufs,
+                MG_ESC("zerocopy"),
+                MG_ESC("threshold"), ZEROCOPY,
+                MG_ESC("sends"), (unsigned long long) zc_sends,
+                MG_ESC("bytes"), (unsigned long long) zc_bytes,
+                MG_ESC("fallback_bytes"), (unsigned long long) zc_copied,
+                MG_ESC("copied_bytes"), (unsigned long long) (stats.bytes_out > zc_bytes ? stats.bytes_out - zc_bytes : 0U),
+                MG_ESC("pinned"), (unsigned long long) zc_pinned,
+                MG_ESC("tls"),
+                MG_ESC("handshakes"), (unsigned long long) stats.tls_handshakes,
+                MG_ESC("ktls"), (unsigned long long) stats.ktls_handshakes,
+                MG_ESC("shedding"),
+                MG_ESC("level"), shed.level,
+                MG_ESC("lag_ms"), (unsigned long long) shed.lag_ms,
+                MG_ESC("lag_max_ms"), (unsigned long long) shed.lag_max_ms,
+                MG_ESC("iteration_max_ms"), (unsigned long long) shed.iteration_max_ms,
+                MG_ESC("escalations"), (unsigned long long) stats.shed_escalations,
+                MG_ESC("recoveries"), (unsigned long long) stats.shed_recoveries,
+                MG_ESC("paced"), (unsigned long long) stats.shed_paced,
+                MG_ESC("skipped"), (unsigned long long) stats.shed_skipped,
+                MG_ESC("rejected"), (unsigned long long) stats.shed_rejected,
+                MG_ESC("admission"),
+                MG_ESC("per_loop"), ADMIT,
+                MG_ESC("per_loop_max"), admit.attempts_max,
+                MG_ESC("admitted"), (unsigned long long) admit.admitted,
+                MG_ESC("rejected"), (unsigned long long) admit.rejected,
+                MG_ESC("paced"), (unsigned long long) stats.admit_paced,
+                MG_ESC("ramping"), (unsigned long) ramping,
+                MG_ESC("storms"),
+                MG_ESC("active"), admit.storm ? "true" : "false",
+                MG_ESC("count"), (unsigned long long) admit.storms,
+                MG_ESC("last_ms"), (unsigned long long) admit.last_storm_ms,
+                MG_ESC("max_ms"), (unsigned long long) admit.max_storm_ms,
+                MG_ESC("last_attempts"), (unsigned long long) admit.last_storm_attempts,
+                MG_ESC("last_lag_max_ms"), (unsigned long long) admit.last_storm_lag_max_ms,
+                MG_ESC("pool"),
+                MG_ESC("workers"), (unsigned long) nyx_pool_workers(),
+                MG_ESC("stages"), pool_stages,
+                MG_ESC("image"),
+                MG_ESC("views"), (unsigned long long) stats.image_views,
+                MG_ESC("bytes"), (unsigned long long) stats.image_bytes,
+                MG_ESC("served"), (unsigned long long) stats.image_served,
+                MG_ESC("mismatched"), (unsigned long long) stats.image_mismatched,
+                MG_ESC("avg_us"), (unsigned long long) (stats.image_views > 0U ? stats.image_sum_us / stats.image_views : 0U),
+                MG_ESC("max_us"), (unsigned long long) stats.image_max_us,
+                MG_ESC("streams"), print_images,
+                MG_ESC("freshness"),
+                MG_ESC("expired"), (unsigned long long) stats.expired,
+                MG_ESC("subscriptions"), print_freshness
+            );
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* ROUTE /cluster                                                                                             */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        else if(mg_match(hm->uri, mg_str("/cluster"), NULL))
+        {
+            if(CLUSTER_NODE[0] == '\0')
+            {
+                mg_http_reply(conn, 404, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "Not in cluster mode\n");
+            }
+            else
+            {
+                char stream[256];
+
+                const int stream_len = mg_http_get_var(&hm->query, "stream", stream, sizeof(stream));
+
+                const struct mg_peer *owner = stream_len > 0 ? nyx_ring_lookup(&ring, nyx_hash((size_t) stream_len, stream, STREAM_MAGIC)) : NULL;
+
+                mg_http_reply(conn, 200, "Access-Control-Allow-Origin: *\r\nContent-Type: application/json\r\n",
+                    "{%m:%m,%m:%m,%m:%llu,%m:[%M]}\n",
+                    MG_ESC("node"), MG_ESC(CLUSTER_NODE),
+                    MG_ESC("owner"), MG_ESC(stream_len <= 0 ? "" : owner != NULL ? owner->name : CLUSTER_NODE),
+                    MG_ESC("redirects"), (unsigned long long) stats.cluster_redirects,
+                    MG_ESC("members"), print_peers
+                );
+            }
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* ROUTE /config/poll                                                                                         */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        else if(mg_match(hm->uri, mg_str("/config/poll"), NULL))
+        {
+            /**/ if(mg_strcasecmp(hm->method, mg_str("POST")) == 0) {
+                mg_http_reply(conn, 200, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "%u\n", POLL_MS = mg_str_to_uint32(hm->body, POLL_MS));
+            }
+            else if(mg_strcasecmp(hm->method, mg_str("GET")) == 0) {
+                mg_http_reply(conn, 200, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "%u\n", /*------*/ POLL_MS /*------*/);
+            }
+            else {
+                mg_http_reply(conn, 405, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "Method not allowed\n");
+            }
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* ROUTE /stop                                                                                                */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        else if(mg_match(hm->uri, mg_str("/stop"), NULL))
+        {
             mg_http_reply(conn, 200, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n", "OK\n");
 
-            s_signo = 1;
+            s_signo = 1;
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* ROUTE *                                                                                                    */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        else
+        {
+            mg_http_reply(conn, 200, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n",
+                "/streams/<device>/<stream>?period=<ms>&batch=<ms>&fragment=<bytes>&weight=<1-64>&priority=<0-3>&max_bps=<bytes/s>&max_age_ms=<ms>&roi=<x>,<y>,<w>,<h>&bin=<1-64> [GET]\n"
+                "/streams?batch=<ms>&fragment=<bytes> [GET]\n"
+                "/streams/<device>/<stream>?from=<ms>&to=<ms> [GET]\n"
+                "/recordings/<device>/<stream>?from=<ms>&to=<ms> [GET]\n"
+                "/stats [GET]\n"
+                "/cluster?stream=<device>/<stream> [GET]\n"
+                "/config/poll [GET, POST]\n"
+                "/stop [GET, POST]\n"
+            );
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* MG_EV_WS_OPEN                                                                                                  */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(event == MG_EV_WS_OPEN)
+    {
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        const struct mg_http_message *hm = event_data;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        uint32_t period_ms;
+        uint32_t batch_ms;
+        uint32_t weight;
+        uint32_t priority;
+        uint64_t max_bps;
+        uint32_t max_age_ms;
+
+        /**/
+        mg_query_to_uint32(hm, "period", &period_ms, 0U);
+        const bool batch = mg_query_to_uint32(hm, "batch", &batch_ms, 0U);
+        mg_query_to_uint32(hm, "weight", &weight, 1U);
+        mg_query_to_uint32(hm, "priority", &priority, EGRESS_DEFAULT_PRIORITY);
+        mg_query_to_uint64(hm, "max_bps", &max_bps, 0U);
+        mg_query_to_uint32(hm, "max_age_ms", &max_age_ms, 0U);
+
+        uint32_t bin;
+        char roi[64];
+
+        mg_query_to_uint32(hm, "bin", &bin, 0U);
+        const int roi_len = mg_http_get_var(&hm->query, "roi", roi, sizeof(roi));
+
+        const struct mg_view view = parse_view(roi_len > 0 ? mg_str_n(roi, (size_t) roi_len) : mg_str_n(NULL, 0U), bin);
+
+        uint32_t fragment_size;
+
+        if(mg_query_to_uint32(hm, "fragment", &fragment_size, 0U) && fragment_size > 0U)
+        {
+            if(fragment_size < FRAGMENT_MIN_SIZE) {
+                fragment_size = FRAGMENT_MIN_SIZE;
+            }
+            if(fragment_size > FRAGMENT_MAX_SIZE) {
+                fragment_size = FRAGMENT_MAX_SIZE;
+            }
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        const bool mux = hm->uri.len <= 9;
+
+        struct mg_session *session = open_session(conn, mux, false, batch, batch_ms, fragment_size);
+
+        if(mux == false)
+        {
+            if(mg_http_var(hm->query, mg_str("from")).buf != NULL)
+            {
+                open_replay(session, hm, mg_str_n(hm->uri.buf + 9, hm->uri.len - 9));
+            }
+            else
+            {
+                const uint32_t hash = add_client(session, mg_str_n(hm->uri.buf + 9, hm->uri.len - 9), period_ms, weight, priority, max_bps, max_age_ms);
+
+                set_view(find_client(session, hash), &view);
+            }
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* MG_EV_WS_MSG                                                                                                   */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(event == MG_EV_WS_MSG)
+    {
+        struct mg_session *session = conn->fn_data;
+
+        if(session != NULL)
+        {
+            nyx_wheel_cancel(&wheel, &session->dead_timer);
+
+            if(session->mux)
+            {
+                mux_handler(session, ((struct mg_ws_message *) event_data)->data);
+            }
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* MG_EV_WS_CTL                                                                                                   */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(event == MG_EV_WS_CTL)
+    {
+        struct mg_session *session = conn->fn_data;
+
+        if(session != NULL)
+        {
+            nyx_wheel_cancel(&wheel, &session->dead_timer);
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* MG_EV_ACCEPT                                                                                                   */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(event == MG_EV_ACCEPT)
+    {
+        if(tls_opts.cert.len > 0)
+        {
+            mg_tls_init(conn, &tls_opts);
+
+            if(KTLS)
+            {
+                nyx_ktls_init(conn);
+            }
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* MG_EV_TLS_HS                                                                                                   */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(event == MG_EV_TLS_HS)
+    {
+        stats.tls_handshakes++;
+
+        if(nyx_ktls_enabled(conn))
+        {
+            stats.ktls_handshakes++;
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* MG_EV_POLL, MG_EV_WRITE                                                                                        */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(event == MG_EV_POLL || event == MG_EV_WRITE)
+    {
+        if(conn->is_websocket == false && conn->fn_data != NULL)
+        {
+            pump_playback(conn);
+        }
+        else if(conn->is_websocket && conn->fn_data != NULL)
+        {
+            if(event == MG_EV_WRITE)
+            {
+                stats.writes++;
+            }
+
+            pump_egress(conn->fn_data, mg_millis(), EGRESS_WATERMARK);
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* MG_EV_CLOSE                                                                                                    */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    else if(event == MG_EV_CLOSE)
+    {
+        if(conn->is_websocket) {
+            close_session(conn);
+        }
+        else {
+            close_playback(conn);
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void mqtt_handler(struct mg_connection *conn, int event, void *event_data)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /**/ if(event == MG_EV_OPEN)
+    {
+        MG_INFO(("%lu MQTT OPEN", conn->id));
+
+        mqtt_conn = conn;
+    }
+    else if(event == MG_EV_MQTT_OPEN && CLUSTER_NODE[0] != '\0')
+    {
+        const struct mg_mqtt_opts opts = {
+            .topic = mg_str("nyx/cluster"),
+            .qos = 0,
+        };
+
+        mg_mqtt_sub(conn, &opts);
+
+        cluster_announce();
+    }
+    else if(event == MG_EV_MQTT_MSG && CLUSTER_NODE[0] != '\0')
+    {
+        const struct mg_mqtt_message *mm = (struct mg_mqtt_message *) event_data;
+
+        if(mg_strcmp(mm->topic, mg_str("nyx/cluster")) == 0 && add_peer(mm->data, false))
+        {
+            rebuild_ring();
+
+            /* The newcomer learns about this instance without waiting for the next ping */
+
+            cluster_announce();
+        }
+    }
+    else if(event == MG_EV_CLOSE)
+    {
+        MG_INFO(("%lu MQTT CLOSE", conn->id));
+
+        mqtt_conn = NULL;
+    }
+    else if(event == MG_EV_ERROR)
+    {
+        MG_ERROR(("MQTT ERROR"));
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void upstream_handler(struct mg_connection *conn, int event, void *event_data)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /**/ if(event == MG_EV_WS_OPEN)
+    {
+        MG_INFO(("%lu UPSTREAM OPEN", conn->id));
+
+        upstream_ready = true;
+
+        upstream_backoff_ms = UPSTREAM_MIN_BACKOFF_MS;
+
+        /* Subscriptions are not kept by the upstream across reconnections */
+
+        for(const struct mg_relay *relay = relays; relay != NULL; relay = relay->next)
+        {
+            if(relay->peer == NULL)
+            {
+                relay_subscribe(relay);
+            }
+        }
+    }
+    else if(event == MG_EV_WS_MSG)
+    {
+        const struct mg_ws_message *wm = (struct mg_ws_message *) event_data;
+
+        if((wm->flags & 0x0F) == WEBSOCKET_OP_BINARY)
+        {
+            parse_frames((const uint8_t *) wm->data.buf, wm->data.len, NULL);
+        }
+        else if(mg_json_get(wm->data, "$.error", NULL) >= 0)
+        {
+            MG_ERROR(("Upstream error: %.*s", (int) wm->data.len, wm->data.buf));
+        }
+    }
+    else if(event == MG_EV_CLOSE)
+    {
+        MG_INFO(("%lu UPSTREAM CLOSE, retrying in %u ms", conn->id, upstream_backoff_ms));
+
+        upstream_conn = NULL;
+
+        upstream_ready = false;
+
+        nyx_wheel_schedule(&wheel, &upstream_timer, mg_millis() + upstream_backoff_ms);
+
+        upstream_backoff_ms = upstream_backoff_ms < UPSTREAM_MAX_BACKOFF_MS / 2U ? 2U * upstream_backoff_ms : UPSTREAM_MAX_BACKOFF_MS;
+    }
+    else if(event == MG_EV_ERROR)
+    {
+        MG_ERROR(("UPSTREAM ERROR: %s", (str_t) event_data));
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void upstream_timer_handler(void *arg)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_mgr *mgr = arg;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(upstream_conn == NULL)
+    {
+        upstream_conn = mg_ws_connect(mgr, UPSTREAM, upstream_handler, NULL, NULL);
+
+        if(upstream_conn == NULL)
+        {
+            MG_ERROR(("Cannot open upstream connection!"));
+
+            nyx_wheel_schedule(&wheel, &upstream_timer, mg_millis() + upstream_backoff_ms);
+        }
+        else
+        {
+            MG_INFO(("Upstream connecting to %s", UPSTREAM));
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void forward_handler(struct mg_connection *conn, int event, void *event_data)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_peer *peer = conn->fn_data;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /**/ if(event == MG_EV_CONNECT)
+    {
+        MG_INFO(("%lu FORWARD OPEN", conn->id));
+    }
+    else if(event == MG_EV_READ)
+    {
+        conn->recv.len = 0U;
+    }
+    else if(event == MG_EV_CLOSE)
+    {
+        MG_INFO(("%lu FORWARD CLOSE", conn->id));
+
+        if(peer != NULL)
+        {
+            peer->fwd_conn = NULL;
+        }
+    }
+    else if(event == MG_EV_ERROR)
+    {
+        MG_ERROR(("FORWARD ERROR: %s", (str_t) event_data));
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void peer_handler(struct mg_connection *conn, int event, void *event_data)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_peer *peer = conn->fn_data;
+
+    if(peer == NULL)
+    {
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /**/ if(event == MG_EV_WS_OPEN)
+    {
+        MG_INFO(("%lu PEER OPEN (`%s`)", conn->id, peer->name));
+
+        peer->ws_ready = true;
+
+        for(const struct mg_relay *relay = relays; relay != NULL; relay = relay->next)
+        {
+            if(relay->peer == peer)
+            {
+                relay_subscribe(relay);
+            }
+        }
+    }
+    else if(event == MG_EV_WS_MSG)
+    {
+        const struct mg_ws_message *wm = (struct mg_ws_message *) event_data;
+
+        if((wm->flags & 0x0F) == WEBSOCKET_OP_BINARY)
+        {
+            parse_frames((const uint8_t *) wm->data.buf, wm->data.len, NULL);
+        }
+        else if(mg_json_get(wm->data, "$.error", NULL) >= 0)
+        {
+            MG_ERROR(("Peer `%s` error: %.*s", peer->name, (int) wm->data.len, wm->data.buf));
+        }
+    }
+    else if(event == MG_EV_CLOSE)
+    {
+        MG_INFO(("%lu PEER CLOSE (`%s`)", conn->id, peer->name));
+
+        peer->ws_conn = NULL;
+
+        peer->ws_ready = false;
+    }
+    else if(event == MG_EV_ERROR)
+    {
+        MG_ERROR(("PEER ERROR: %s", (str_t) event_data));
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void cluster_timer_handler(void *arg)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_mgr *mgr = arg;
+
+    const uint64_t now = mg_millis();
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* MEMBERSHIP                                                                                                     */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(struct mg_peer **pp = &peers; *pp != NULL;)
+    {
+        struct mg_peer *peer = *pp;
+
+        if(peer->is_static == false && now - peer->seen_ms > CLUSTER_EXPIRE_MS)
+        {
+            *pp = peer->next;
+
+            MG_INFO(("Cluster member `%s` expired", peer->name));
+
+            /* Relays leave the peer before it is freed */
+
+            rebuild_ring();
+
+            free_peer(peer);
+        }
+        else
+        {
+            pp = &peer->next;
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* CONNECTIONS                                                                                                    */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(struct mg_peer *peer = peers; peer != NULL; peer = peer->next)
+    {
+        if(peer->fwd_conn == NULL)
+        {
+            peer->fwd_conn = mg_connect(mgr, peer->tcp_url, forward_handler, peer);
+
+            if(peer->fwd_conn != NULL)
+            {
+                /* Queued ahead of any forwarded frame */
+
+                uint8_t hello[STREAM_HEADER_SIZE];
+
+                nyx_write_u32_le(hello + 0, STREAM_MAGIC);
+                nyx_write_u32_le(hello + 4, CLUSTER_HELLO);
+                nyx_write_u32_le(hello + 8, 0U);
+
+                mg_send(peer->fwd_conn, hello, sizeof(hello));
+            }
+        }
+
+        if(peer->ws_conn == NULL)
+        {
+            peer->ws_conn = mg_ws_connect(mgr, peer->ws_url, peer_handler, peer, NULL);
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    nyx_wheel_schedule(&wheel, &cluster_timer, now + RETRY_MS);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void retry_timer_handler(void *arg)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_mgr *mgr = arg;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* TCP CONNECTION                                                                                                 */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(tcp_conn == NULL)
+    {
+        tcp_conn = mg_listen(mgr, TCP_URL, tcp_handler, NULL);
+
+        if(tcp_conn == NULL)
+        {
+            MG_ERROR(("Cannot create TCP listener!"));
+        }
+        else
+        {
+            MG_INFO(("TCP listening on %s", TCP_URL));
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* HTTP CONNECTION                                                                                                */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(http_conn == NULL)
+    {
+        http_conn = mg_http_listen(mgr, HTTP_URL, http_handler, NULL);
+
+        if(http_conn == NULL)
+        {
+            MG_ERROR(("Cannot create HTTP listener!"));
+        }
+        else
+        {
+            MG_INFO(("HTTP listening on %s", HTTP_URL));
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* SUB CONNECTION                                                                                                 */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(sub_conn == NULL && SUB_URL[0] != '\0')
+    {
+        sub_conn = mg_listen(mgr, SUB_URL, sub_handler, NULL);
+
+        if(sub_conn == NULL)
+        {
+            MG_ERROR(("Cannot create SUB listener!"));
+        }
+        else
+        {
+            MG_INFO(("SUB listening on %s", SUB_URL));
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+    /* MQTT CONNECTION                                                                                                */
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(mqtt_conn == NULL)
+    {
+        /* Cluster members share the broker, their client identifiers must differ */
+
+        char client_id[128];
+
+        mg_snprintf(client_id, sizeof(client_id), CLUSTER_NODE[0] != '\0' ? "nyx-stream-%s" : "nyx-stream", CLUSTER_NODE);
+
+        const struct mg_mqtt_opts mqtt_opts = {
+            .client_id = mg_str(client_id),
+            .user = mg_str(MQTT_USERNAME),
+            .pass = mg_str(MQTT_PASSWORD),
+            .version = 0x04,
+            .clean = true,
+        };
+
+        mqtt_conn = mg_mqtt_connect(mgr, MQTT_URL, &mqtt_opts, mqtt_handler, NULL);
+
+        if(mqtt_conn == NULL)
+        {
+            MG_ERROR(("Cannot open MQTT connection!"));
+        }
+        else
+        {
+            MG_INFO(("MQTT connected to %s", MQTT_URL));
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void ping_timer_handler(__NYX_UNUSED__ void *arg)
+{
+    if(mqtt_conn != NULL)
+    {
+        const struct mg_mqtt_opts opts = {
+            .topic = mg_str("nyx/ping/special"),
+            .message = mg_str("$$nyx-stream-server$$"),
+            .qos = 0,
+        };
+
+        mg_mqtt_pub(mqtt_conn, &opts);
+    }
+
+    cluster_announce();
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* HANDOFF                                                                                                            */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct mg_handoff
+{
+    uint32_t type;
+
+    uint32_t mux;
+    uint32_t batch;
+    uint32_t batch_ms;
+    uint32_t fragment_size;
+
+    uint32_t client_cnt;
+
+    uint64_t recv_size;
+    uint64_t send_size;
+
+    uint32_t peer;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct mg_handoff_client
+{
+    uint32_t period_ms;
+    uint32_t weight;
+    uint32_t priority;
+
+    uint32_t name_len;
+
+    uint64_t max_bps;
+
+    struct mg_view view;
+
+    uint32_t max_age_ms;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static str_t *s_argv = NULL;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool handoff_conn(const int sock, const struct mg_connection *conn, const uint32_t type, const struct mg_session *session)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct mg_handoff record;
+
+    memset(&record, 0x00, sizeof(struct mg_handoff));
+
+    record.type = type;
+    record.recv_size = conn->recv.len;
+    record.send_size = conn->send.len;
+
+    if(type == HANDOFF_PRODUCER && conn->fn_data != NULL)
+    {
+        record.peer = ((const struct mg_producer *) conn->fn_data)->peer;
+    }
+
+    if(session != NULL)
+    {
+        record.mux = session->mux;
+        record.batch = session->batch;
+        record.batch_ms = session->batch_ms;
+        record.fragment_size = session->fragment_size;
+
+        for(const struct mg_client *client = clients; client != NULL; client = client->next)
+        {
+            if(client->session == session)
+            {
+                record.client_cnt++;
+            }
         }
+    }
 
-        /*------------------------------------------------------------------------------------------------------------*/
-        /* ROUTE *                                                                                                    */
-        /*------------------------------------------------------------------------------------------------------------*/
+    if(nyx_handoff_send(sock, (int) (size_t) conn->fd, &record, sizeof(struct mg_handoff)) == false)
+    {
+        return false;
+    }
 
-        else
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(const struct mg_client *client = clients; session != NULL && client != NULL; client = client->next)
+    {
+        if(client->session == session)
         {
-            mg_http_reply(conn, 200, "Access-Control-Allow-Origin: *\r\nContent-Type: text/plain\r\n",
-                "/streams/<device>/<stream>?period=<ms> [GET]\n"
-                "/config/poll [GET, POST]\n"
-                "/stop [GET, POST]\n"
-            );
+            const struct mg_handoff_client entry = {
+                .period_ms = client->period_ms,
+                .weight = client->weight,
+                .priority = client->priority,
+                .name_len = (uint32_t) strlen(client->name),
+                .max_bps = client->max_bps,
+                .view = client->view,
+                .max_age_ms = client->max_age_ms,
+            };
+
+            if(nyx_handoff_send(sock, -1, &entry, sizeof(struct mg_handoff_client)) == false
+               ||
+               nyx_handoff_send(sock, -1, client->name, entry.name_len) == false
+            ) {
+                return false;
+            }
         }
+    }
 
-        /*------------------------------------------------------------------------------------------------------------*/
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Bytes read but not parsed yet, bytes queued but not written yet */
+
+    return nyx_handoff_send(sock, -1, conn->recv.buf, conn->recv.len)
+           &&
+           nyx_handoff_send(sock, -1, conn->send.buf, conn->send.len)
+    ;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool handoff(struct mg_mgr *mgr)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    MG_INFO(("Handing off to a new process..."));
+
+    int pid;
+
+    const int sock = nyx_handoff_spawn(s_argv, &pid);
+
+    if(sock < 0)
+    {
+        MG_ERROR(("Cannot spawn `%s`", s_argv[0]));
+
+        return false;
     }
 
     /*----------------------------------------------------------------------------------------------------------------*/
-    /* MG_EV_WS_OPEN                                                                                                  */
+
+    uint32_t version;
+
+    if(nyx_handoff_recv(sock, NULL, &version, sizeof(uint32_t)) == false || version != HANDOFF_VERSION)
+    {
+        MG_ERROR(("New process not ready, keeping on serving"));
+
+        goto _err;
+    }
+
     /*----------------------------------------------------------------------------------------------------------------*/
 
-    else if(event == MG_EV_WS_OPEN)
+    /* Producers read through the ring go back to epoll first, the ring must not consume what the new process reads */
+
+    release_producers();
+
+    /* TLS state cannot be transferred, replays and playbacks are dropped */
+
+    const uint64_t now = mg_millis();
+
+    size_t conn_cnt = 0U;
+
+    for(struct mg_connection *conn = mgr->conns; conn != NULL; conn = conn->next)
     {
-        /*------------------------------------------------------------------------------------------------------------*/
+        bool done = true;
+
+        /**/ if(conn == tcp_conn)
+        {
+            done = handoff_conn(sock, conn, HANDOFF_TCP_LISTENER, NULL);
+        }
+        else if(conn == http_conn)
+        {
+            done = handoff_conn(sock, conn, HANDOFF_HTTP_LISTENER, NULL);
+        }
+        else if(conn == sub_conn)
+        {
+            done = handoff_conn(sock, conn, HANDOFF_SUB_LISTENER, NULL);
+        }
+        else if(conn->fn == tcp_handler && conn->is_accepted && conn->is_closing == false)
+        {
+            done = handoff_conn(sock, conn, HANDOFF_PRODUCER, NULL);
+        }
+        else if(conn->fn == http_handler && conn->is_websocket && conn->is_tls == false && conn->is_closing == false && conn->is_draining == false && conn->fn_data != NULL)
+        {
+            struct mg_session *session = conn->fn_data;
+
+            if(session->replay != NULL)
+            {
+                continue;
+            }
+
+            /* Everything already scheduled goes with the socket */
+
+            flush_batch(session, now);
+
+            pump_egress(session, now, SIZE_MAX);
+
+            done = handoff_conn(sock, conn, HANDOFF_SESSION, session);
+        }
+        else if(conn->fn == sub_handler && conn->is_accepted && conn->is_closing == false && conn->fn_data != NULL)
+        {
+            struct mg_session *session = conn->fn_data;
+
+            pump_egress(session, now, SIZE_MAX);
 
-        uint32_t period_ms = 0U;
+            flush_raw(session, now);
 
-        if(*(str_t) conn->data != '\0')
+            done = handoff_conn(sock, conn, HANDOFF_SUB_SESSION, session);
+        }
+        else
         {
-            period_ms = mg_str_to_uint32(mg_str(conn->data), 0U);
+            continue;
         }
 
-        /*------------------------------------------------------------------------------------------------------------*/
+        if(done == false)
+        {
+            MG_ERROR(("Cannot hand off connection %lu, keeping on serving", conn->id));
 
-        add_client(conn, mg_str(conn->fn_data), period_ms);
+            goto _err;
+        }
 
-        /*------------------------------------------------------------------------------------------------------------*/
+        conn_cnt++;
     }
 
-    /*----------------------------------------------------------------------------------------------------------------*/
-    /* MG_EV_CLOSE                                                                                                    */
     /*----------------------------------------------------------------------------------------------------------------*/
 
-    else if(event == MG_EV_CLOSE)
+    const struct mg_handoff end = {
+        .type = HANDOFF_END,
+    };
+
+    uint8_t ack;
+
+    if(nyx_handoff_send(sock, -1, &end, sizeof(struct mg_handoff)) == false || nyx_handoff_recv(sock, NULL, &ack, sizeof(uint8_t)) == false)
     {
-        rm_client(conn); free(conn->fn_data);
+        MG_ERROR(("New process did not acknowledge, keeping on serving"));
+
+        goto _err;
     }
 
     /*----------------------------------------------------------------------------------------------------------------*/
+
+    MG_INFO(("Handed off %lu connections to process %d", (unsigned long) conn_cnt, pid));
+
+    close(sock);
+
+    return true;
+
+_err:
+    nyx_handoff_abort(sock, pid);
+
+    return false;
 }
 
 /*--------------------------------------------------------------------------------------------------------------------*/
 
-static void mqtt_handler(struct mg_connection *conn, int event, __NYX_UNUSED__ void *event_data)
+static void adopt_addr(struct mg_addr *addr, const struct sockaddr_storage *ss)
 {
-    /*----------------------------------------------------------------------------------------------------------------*/
+    memset(addr, 0x00, sizeof(struct mg_addr));
 
-    /**/ if(event == MG_EV_OPEN)
+    if(ss->ss_family == AF_INET6)
     {
-        MG_INFO(("%lu MQTT OPEN", conn->id));
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) ss;
 
-        mqtt_conn = conn;
+        memcpy(addr->ip, &sin6->sin6_addr, 16);
+        addr->port = sin6->sin6_port;
+        addr->is_ip6 = true;
     }
-    else if(event == MG_EV_CLOSE)
+    else
     {
-        MG_INFO(("%lu MQTT CLOSE", conn->id));
+        const struct sockaddr_in *sin = (const struct sockaddr_in *) ss;
 
-        mqtt_conn = NULL;
+        memcpy(addr->ip, &sin->sin_addr, 4);
+        addr->port = sin->sin_port;
+        addr->is_ip6 = false;
     }
-    else if(event == MG_EV_ERROR)
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool adopt_bytes(const int sock, struct mg_iobuf *iobuf, const size_t size)
+{
+    if(size == 0U)
     {
-        MG_ERROR(("MQTT ERROR"));
+        return true;
     }
 
-    /*----------------------------------------------------------------------------------------------------------------*/
+    if(mg_iobuf_add(iobuf, iobuf->len, NULL, size) != size)
+    {
+        return false;
+    }
+
+    return nyx_handoff_recv(sock, NULL, iobuf->buf + iobuf->len - size, size);
 }
 
 /*--------------------------------------------------------------------------------------------------------------------*/
 
-static void retry_timer_handler(void *arg)
+static bool adopt_session(const int sock, struct mg_connection *conn, const struct mg_handoff *record)
 {
     /*----------------------------------------------------------------------------------------------------------------*/
 
-    struct mg_mgr *mgr = arg;
+    const bool raw = record->type == HANDOFF_SUB_SESSION;
+
+    if(raw == false)
+    {
+        /* Replays the upgrade for mongoose's WebSocket framing, the peer already got its 101 */
+
+        struct mg_http_message hm;
+
+        memset(&hm, 0x00, sizeof(struct mg_http_message));
+
+        hm.headers[0].name = mg_str("Sec-WebSocket-Key");
+        hm.headers[0].value = mg_str("handoff");
+
+        mg_ws_upgrade(conn, &hm, NULL);
+
+        conn->send.len = 0U;
+
+        conn->fn = http_handler;
+    }
 
-    /*----------------------------------------------------------------------------------------------------------------*/
-    /* TCP CONNECTION                                                                                                 */
     /*----------------------------------------------------------------------------------------------------------------*/
 
-    if(tcp_conn == NULL)
+    struct mg_session *session = open_session(conn, record->mux != 0U, raw, record->batch != 0U, record->batch_ms, record->fragment_size);
+
+    for(uint32_t i = 0U; i < record->client_cnt; i++)
     {
-        tcp_conn = mg_listen(mgr, TCP_URL, tcp_handler, NULL);
+        struct mg_handoff_client entry;
 
-        if(tcp_conn == NULL)
+        if(nyx_handoff_recv(sock, NULL, &entry, sizeof(struct mg_handoff_client)) == false)
         {
-            MG_ERROR(("Cannot create TCP listener!"));
+            return false;
         }
-        else
+
+        str_t name = nyx_memory_alloc(entry.name_len + 1U);
+
+        if(nyx_handoff_recv(sock, NULL, name, entry.name_len) == false)
         {
-            MG_INFO(("TCP listening on %s", TCP_URL));
+            nyx_memory_free(name);
+
+            return false;
         }
+
+        const uint32_t hash = add_client(session, mg_str_n(name, entry.name_len), entry.period_ms, entry.weight, entry.priority, entry.max_bps, entry.max_age_ms);
+
+        struct mg_client *client = find_client(session, hash);
+
+        set_view(client, &entry.view);
+
+        /* Not a new subscriber, no ramp */
+
+        client->ramp_ms = 0U;
+
+        nyx_memory_free(name);
     }
 
     /*----------------------------------------------------------------------------------------------------------------*/
-    /* HTTP CONNECTION                                                                                                */
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool adopt(struct mg_mgr *mgr, const int sock)
+{
     /*----------------------------------------------------------------------------------------------------------------*/
 
-    if(http_conn == NULL)
+    const uint32_t version = HANDOFF_VERSION;
+
+    if(nyx_handoff_send(sock, -1, &version, sizeof(uint32_t)) == false)
     {
-        http_conn = mg_http_listen(mgr, HTTP_URL, http_handler, NULL);
+        return false;
+    }
 
-        if(http_conn == NULL)
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* mongoose's HTTP protocol handler is private, borrow it from a throwaway listener */
+
+    struct mg_connection *tmp_conn = mg_http_listen(mgr, "http://127.0.0.1:0", http_handler, NULL);
+
+    if(tmp_conn == NULL)
+    {
+        return false;
+    }
+
+    const mg_event_handler_t http_cb = tmp_conn->pfn;
+
+    tmp_conn->is_closing = 1;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    size_t conn_cnt = 0U;
+
+    for(;;)
+    {
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        int fd;
+
+        struct mg_handoff record;
+
+        if(nyx_handoff_recv(sock, &fd, &record, sizeof(struct mg_handoff)) == false)
         {
-            MG_ERROR(("Cannot create HTTP listener!"));
+            return false;
         }
-        else
+
+        if(record.type == HANDOFF_END)
         {
-            MG_INFO(("HTTP listening on %s", HTTP_URL));
+            break;
         }
-    }
 
-    /*----------------------------------------------------------------------------------------------------------------*/
-    /* MQTT CONNECTION                                                                                                */
-    /*----------------------------------------------------------------------------------------------------------------*/
+        /*------------------------------------------------------------------------------------------------------------*/
 
-    if(mqtt_conn == NULL)
-    {
-        const struct mg_mqtt_opts mqtt_opts = {
-            .client_id = mg_str("nyx-stream"),
-            .user = mg_str(MQTT_USERNAME),
-            .pass = mg_str(MQTT_PASSWORD),
-            .version = 0x04,
-            .clean = true,
-        };
+        mg_event_handler_t fn;
+
+        switch(record.type)
+        {
+            case HANDOFF_HTTP_LISTENER:
+                fn = http_handler;
+                break;
+
+            case HANDOFF_SESSION:
+                /* Set once upgraded */
+                fn = NULL;
+                break;
+
+            case HANDOFF_SUB_LISTENER:
+            case HANDOFF_SUB_SESSION:
+                fn = sub_handler;
+                break;
+
+            default:
+                fn = tcp_handler;
+                break;
+        }
+
+        struct mg_connection *conn = fd >= 0 ? mg_wrapfd(mgr, fd, fn, NULL) : NULL;
+
+        if(conn == NULL)
+        {
+            if(fd >= 0) {
+                close(fd);
+            }
+
+            return false;
+        }
+
+        struct sockaddr_storage ss;
+
+        socklen_t ss_len = sizeof(struct sockaddr_storage);
+
+        if(getsockname(fd, (struct sockaddr *) &ss, &ss_len) == 0) {
+            adopt_addr(&conn->loc, &ss);
+        }
+
+        ss_len = sizeof(struct sockaddr_storage);
+
+        if(getpeername(fd, (struct sockaddr *) &ss, &ss_len) == 0) {
+            adopt_addr(&conn->rem, &ss);
+        }
 
-        mqtt_conn = mg_mqtt_connect(mgr, MQTT_URL, &mqtt_opts, mqtt_handler, NULL);
+        /*------------------------------------------------------------------------------------------------------------*/
 
-        if(mqtt_conn == NULL)
+        switch(record.type)
         {
-            MG_ERROR(("Cannot open MQTT connection!"));
+            case HANDOFF_TCP_LISTENER:
+                conn->is_listening = 1;
+                tcp_conn = conn;
+                break;
+
+            case HANDOFF_HTTP_LISTENER:
+                conn->is_listening = 1;
+                conn->pfn = http_cb;
+                http_conn = conn;
+                break;
+
+            case HANDOFF_SUB_LISTENER:
+                conn->is_listening = 1;
+                sub_conn = conn;
+                break;
+
+            case HANDOFF_PRODUCER:
+                conn->is_accepted = 1;
+                open_producer(conn);
+                ((struct mg_producer *) conn->fn_data)->peer = record.peer != 0U;
+                break;
+
+            default:
+                conn->is_accepted = 1;
+
+                if(adopt_session(sock, conn, &record) == false)
+                {
+                    return false;
+                }
+                break;
         }
-        else
-        {
-            MG_INFO(("MQTT connected to %s", MQTT_URL));
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        if(adopt_bytes(sock, &conn->recv, record.recv_size) == false
+           ||
+           adopt_bytes(sock, &conn->send, record.send_size) == false
+        ) {
+            return false;
         }
+
+        conn_cnt++;
+
+        /*------------------------------------------------------------------------------------------------------------*/
     }
 
     /*----------------------------------------------------------------------------------------------------------------*/
-}
 
-/*--------------------------------------------------------------------------------------------------------------------*/
+    const uint8_t ack = 1U;
 
-static void keepalive_timer_handler(__NYX_UNUSED__ void *arg)
-{
-    for(const struct mg_client *client = clients; client != NULL; client = client->next)
+    if(nyx_handoff_send(sock, -1, &ack, sizeof(uint8_t)) == false)
     {
-        mg_ws_send(client->conn, "", 0x00, WEBSOCKET_OP_PING);
+        return false;
     }
-}
 
-/*--------------------------------------------------------------------------------------------------------------------*/
+    MG_INFO(("Adopted %lu connections", (unsigned long) conn_cnt));
 
-static void ping_timer_handler(__NYX_UNUSED__ void *arg)
-{
-    if(mqtt_conn != NULL)
-    {
-        const struct mg_mqtt_opts opts = {
-            .topic = mg_str("nyx/ping/special"),
-            .message = mg_str("$$nyx-stream-server$$"),
-            .qos = 0,
-        };
+    /*----------------------------------------------------------------------------------------------------------------*/
 
-        mg_mqtt_pub(mqtt_conn, &opts);
-    }
+    return true;
 }
 
 /*--------------------------------------------------------------------------------------------------------------------*/
@@ -623,6 +5666,47 @@ static void compute_token(char result[17], STR_t username, STR_t password)
 
 /*--------------------------------------------------------------------------------------------------------------------*/
 
+static void parse_ceilings(STR_t list, struct mg_ceiling **ceilings, size_t *ceiling_cnt)
+{
+    for(struct mg_str s = mg_str(list), entry; mg_span(s, &entry, &s, ',');)
+    {
+        struct mg_str key;
+        struct mg_str value;
+
+        if(entry.len == 0)
+        {
+            continue;
+        }
+
+        /* Same 64-bit range as the buckets, a malformed ceiling must not silently mean unlimited */
+
+        uint64_t rate_bps = 0U;
+
+        if(mg_span(entry, &key, &value, '=') == false || key.len == 0 || mg_str_to_num(value, 10, &rate_bps, sizeof(uint64_t)) == false || rate_bps == 0U)
+        {
+            MG_ERROR(("Invalid rate ceiling `%.*s`, expected `<key>=<bytes per second>`", (int) entry.len, entry.buf));
+
+            exit(1);
+        }
+
+        *ceilings = nyx_memory_realloc(*ceilings, (*ceiling_cnt + 1U) * sizeof(struct mg_ceiling));
+
+        struct mg_ceiling *ceiling = &(*ceilings)[(*ceiling_cnt)++];
+
+        memset(ceiling, 0x00, sizeof(struct mg_ceiling));
+
+        ceiling->key = nyx_memory_alloc(key.len + 1U);
+        memcpy(ceiling->key, key.buf, key.len);
+        ceiling->key[key.len] = '\0';
+
+        ceiling->hash = nyx_hash(key.len, key.buf, STREAM_MAGIC);
+
+        ceiling->rate_bps = rate_bps;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
 static void parse_args(const int argc, str_t *argv)
 {
     /*----------------------------------------------------------------------------------------------------------------*/
@@ -633,6 +5717,20 @@ static void parse_args(const int argc, str_t *argv)
     str_t mqtt_username;
     str_t mqtt_password;
     str_t poll_ms;
+    str_t record;
+    str_t record_dir;
+    str_t tls_cert;
+    str_t tls_key;
+    str_t upstream;
+    str_t shed_lag_ms;
+    str_t sub_url;
+    str_t stream_bps;
+    str_t addr_bps;
+    str_t cluster_node;
+    str_t cluster;
+    str_t zerocopy;
+    str_t images;
+    str_t admit;
 
     if(nyx_load_config(
         &tcp_url,
@@ -640,7 +5738,21 @@ static void parse_args(const int argc, str_t *argv)
         &mqtt_url,
         &mqtt_username,
         &mqtt_password,
-        &poll_ms
+        &poll_ms,
+        &record,
+        &record_dir,
+        &tls_cert,
+        &tls_key,
+        &upstream,
+        &shed_lag_ms,
+        &sub_url,
+        &stream_bps,
+        &addr_bps,
+        &cluster_node,
+        &cluster,
+        &zerocopy,
+        &images,
+        &admit
     )) {
         if(tcp_url != NULL) TCP_URL = tcp_url;
         if(http_url != NULL) HTTP_URL = http_url;
@@ -650,6 +5762,30 @@ static void parse_args(const int argc, str_t *argv)
         if(mqtt_password != NULL) MQTT_PASSWORD = mqtt_password;
 
         if(poll_ms != NULL) mg_str_to_uint32(mg_str(optarg), POLL_MS);
+
+        if(record != NULL) RECORD = record;
+        if(record_dir != NULL) RECORD_DIR = record_dir;
+
+        if(tls_cert != NULL) TLS_CERT = tls_cert;
+        if(tls_key != NULL) TLS_KEY = tls_key;
+
+        if(upstream != NULL) UPSTREAM = upstream;
+
+        if(shed_lag_ms != NULL) SHED_LAG_MS = mg_str_to_uint32(mg_str(shed_lag_ms), SHED_LAG_MS);
+
+        if(sub_url != NULL) SUB_URL = sub_url;
+
+        if(stream_bps != NULL) STREAM_BPS = stream_bps;
+        if(addr_bps != NULL) ADDR_BPS = addr_bps;
+
+        if(cluster_node != NULL) CLUSTER_NODE = cluster_node;
+        if(cluster != NULL) CLUSTER = cluster;
+
+        if(zerocopy != NULL) ZEROCOPY = mg_str_to_uint32(mg_str(zerocopy), ZEROCOPY);
+
+        if(images != NULL) IMAGES = images;
+
+        if(admit != NULL) ADMIT = mg_str_to_uint32(mg_str(admit), ADMIT);
     }
 
     /*----------------------------------------------------------------------------------------------------------------*/
@@ -664,6 +5800,34 @@ static void parse_args(const int argc, str_t *argv)
         /**/
         {"poll",     required_argument, 0, 'l'},
         /**/
+        {"record",     required_argument, 0, 'r'},
+        {"record-dir", required_argument, 0, 'd'},
+        /**/
+        {"io-uring",   no_argument,       0, 'U'},
+        {"zerocopy",   required_argument, 0, 'Z'},
+        /**/
+        {"tls-cert",   required_argument, 0, 'c'},
+        {"tls-key",    required_argument, 0, 'k'},
+        {"ktls",       no_argument,       0, 'K'},
+        /**/
+        {"upstream",   required_argument, 0, 'R'},
+        /**/
+        {"shed-lag",   required_argument, 0, 'L'},
+        {"admit",      required_argument, 0, 'a'},
+        /**/
+        {"workers",    required_argument, 0, 'W'},
+        {"dedup",      no_argument,       0, 'D'},
+        /**/
+        {"sub-url",    required_argument, 0, 'S'},
+        /**/
+        {"stream-bps", required_argument, 0, 'B'},
+        {"addr-bps",   required_argument, 0, 'A'},
+        /**/
+        {"cluster-node", required_argument, 0, 'N'},
+        {"cluster",      required_argument, 0, 'C'},
+        /**/
+        {"images",     required_argument, 0, 'I'},
+        /**/
         {"help",     no_argument,       0, 999},
         /**/
         {0, 0, 0, 0},
@@ -675,7 +5839,7 @@ static void parse_args(const int argc, str_t *argv)
     {
         /*------------------------------------------------------------------------------------------------------------*/
 
-        const int opt = getopt_long(argc, argv, "t:h:m:u:p:l:", long_options, NULL);
+        const int opt = getopt_long(argc, argv, "t:h:m:u:p:l:r:d:UZ:c:k:KR:L:a:W:DS:B:A:N:C:I:", long_options, NULL);
 
         if(opt < 0)
         {
@@ -695,6 +5859,34 @@ static void parse_args(const int argc, str_t *argv)
 
             case 'l': POLL_MS       = mg_str_to_uint32(mg_str(optarg), POLL_MS); break;
 
+            case 'r': RECORD        = optarg; break;
+            case 'd': RECORD_DIR    = optarg; break;
+
+            case 'U': IO_URING      = true; break;
+            case 'Z': ZEROCOPY      = mg_str_to_uint32(mg_str(optarg), ZEROCOPY); break;
+
+            case 'c': TLS_CERT      = optarg; break;
+            case 'k': TLS_KEY       = optarg; break;
+            case 'K': KTLS          = true; break;
+
+            case 'R': UPSTREAM      = optarg; break;
+
+            case 'L': SHED_LAG_MS   = mg_str_to_uint32(mg_str(optarg), SHED_LAG_MS); break;
+            case 'a': ADMIT         = mg_str_to_uint32(mg_str(optarg), ADMIT); break;
+
+            case 'W': WORKERS       = mg_str_to_uint32(mg_str(optarg), WORKERS); break;
+            case 'D': DEDUP         = true; break;
+
+            case 'S': SUB_URL       = optarg; break;
+
+            case 'B': STREAM_BPS    = optarg; break;
+            case 'A': ADDR_BPS      = optarg; break;
+
+            case 'N': CLUSTER_NODE  = optarg; break;
+            case 'C': CLUSTER       = optarg; break;
+
+            case 'I': IMAGES        = optarg; break;
+
             default:
                 printf("Usage: %s [options]\n", argv[0]);
                 printf("\n");
@@ -706,6 +5898,34 @@ static void parse_args(const int argc, str_t *argv)
                 printf("  -p --password <password>  Password for both HTTP and MQTT\n");
                 printf("\n");
                 printf("  -l --poll <ms>            Poll interval (default: %u ms)\n", POLL_MS);
+                printf("\n");
+                printf("  -r --record <streams>     Comma-separated list of streams to record, `*` for all\n");
+                printf("  -d --record-dir <path>    Recording directory (default: `%s`)\n", RECORD_DIR);
+                printf("\n");
+                printf("  -U --io-uring             Producer ingest and batched subscriber egress through io_uring, if supported\n");
+                printf("  -Z --zerocopy <bytes>     Zero-copy raw subscriber frames from this size on, needs io_uring (default: disabled)\n");
+                printf("\n");
+                printf("  -c --tls-cert <path>      TLS certificate (PEM) for an `https://` HTTP URL\n");
+                printf("  -k --tls-key <path>       TLS private key (PEM) for an `https://` HTTP URL\n");
+                printf("  -K --ktls                 Offload TLS record encryption to the kernel, if supported\n");
+                printf("\n");
+                printf("  -R --upstream <url>       Relay mode, subscribe to an upstream `ws://<host>:<port>/streams`\n");
+                printf("\n");
+                printf("  -L --shed-lag <ms>        Loop lag above which load is shed, 0 to disable (default: %u ms)\n", SHED_LAG_MS);
+                printf("  -a --admit <n>            New subscriptions admitted per loop iteration, ramping up, 0 for no limit (default: %u)\n", ADMIT);
+                printf("\n");
+                printf("  -W --workers <n>          Worker threads for the frame pipeline, 0 to run it inline (default: %u)\n", WORKERS);
+                printf("  -D --dedup                Drop frames identical to the previous one of their stream\n");
+                printf("\n");
+                printf("  -S --sub-url <url>        Raw TCP subscriber listener, e.g. `tcp://0.0.0.0:8889` (default: disabled)\n");
+                printf("\n");
+                printf("  -B --stream-bps <list>    Comma-separated `<stream>=<bytes/s>` ceilings for each subscription of a stream\n");
+                printf("  -A --addr-bps <list>      Comma-separated `<ip>=<bytes/s>` ceilings for all subscriptions of an address\n");
+                printf("\n");
+                printf("  -N --cluster-node <node>  Cluster mode, this instance as `<host>:<tcp port>:<http port>` (default: disabled)\n");
+                printf("  -C --cluster <list>       Comma-separated static cluster members, the others are announced over MQTT\n");
+                printf("\n");
+                printf("  -I --images <list>        Comma-separated `<stream>=<width>x<height>:<u8|u16|u32|f32>` image streams, enables `roi` and `bin`\n");
 
                 exit(0);
         }
@@ -715,6 +5935,17 @@ static void parse_args(const int argc, str_t *argv)
 
     /*----------------------------------------------------------------------------------------------------------------*/
 
+#if MG_TLS == MG_TLS_NONE
+    if(mg_url_is_ssl(HTTP_URL))
+    {
+        MG_ERROR(("Cannot serve `%s`, this build has no TLS support (rebuild with OpenSSL)", HTTP_URL));
+
+        exit(1);
+    }
+#endif
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
     if(MQTT_USERNAME[0] != '\0'
        ||
        MQTT_PASSWORD[0] != '\0'
@@ -723,6 +5954,54 @@ static void parse_args(const int argc, str_t *argv)
     }
 
     /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(struct mg_str s = mg_str(RECORD), name; mg_span(s, &name, &s, ',');)
+    {
+        if(name.len > 0)
+        {
+            record_hashes = nyx_memory_realloc(record_hashes, (record_cnt + 1U) * sizeof(uint32_t));
+
+            /* The null hash stands for all streams */
+
+            record_hashes[record_cnt++] = mg_strcmp(name, mg_str("*")) == 0 ? 0x00 : nyx_hash(name.len, name.buf, STREAM_MAGIC);
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    parse_ceilings(STREAM_BPS, &stream_ceilings, &stream_ceiling_cnt);
+
+    parse_ceilings(ADDR_BPS, &addr_ceilings, &addr_ceiling_cnt);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    parse_images(IMAGES);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(CLUSTER_NODE[0] != '\0')
+    {
+        struct mg_str host, tcp_port, http_port;
+
+        if(parse_member(mg_str(CLUSTER_NODE), &host, &tcp_port, &http_port) == false)
+        {
+            MG_ERROR(("Invalid cluster node `%s`, expected `<host>:<tcp port>:<http port>`", CLUSTER_NODE));
+
+            exit(1);
+        }
+
+        for(struct mg_str s = mg_str(CLUSTER), name; mg_span(s, &name, &s, ',');)
+        {
+            if(name.len > 0)
+            {
+                add_peer(name, true);
+            }
+        }
+
+        rebuild_ring();
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
 }
 
 /*--------------------------------------------------------------------------------------------------------------------*/
@@ -731,6 +6010,8 @@ int main(const int argc, str_t *argv)
 {
     /*----------------------------------------------------------------------------------------------------------------*/
 
+    s_argv = argv;
+
     parse_args(argc, argv);
 
     /*----------------------------------------------------------------------------------------------------------------*/
@@ -747,9 +6028,81 @@ int main(const int argc, str_t *argv)
 
     mg_mgr_init(&mgr);
 
-    /*----------------------------------------------------------------------------------------------------------------*/
+    nyx_wheel_init(&wheel, mg_millis());
+
+    if(record_cnt > 0U)
+    {
+        nyx_recorder_start(RECORD_DIR);
+    }
+
+    if(mg_url_is_ssl(HTTP_URL))
+    {
+        tls_opts.cert = mg_file_read(&mg_fs_posix, TLS_CERT);
+        tls_opts.key = mg_file_read(&mg_fs_posix, TLS_KEY);
+
+        if(tls_opts.cert.len == 0 || tls_opts.key.len == 0)
+        {
+            MG_ERROR(("Cannot read TLS certificate `%s` or key `%s`", TLS_CERT, TLS_KEY));
+
+            return 1;
+        }
+    }
+
+    if(IO_URING)
+    {
+        if(nyx_uring_init(URING_ENTRIES)) {
+            MG_INFO(("Using io_uring for egress"));
+        }
+        else {
+            MG_ERROR(("io_uring not available, falling back to epoll"));
+        }
+    }
+
+    if(nyx_uring_enabled())
+    {
+        /* Wakes the loop up when receives complete, edge-triggered: every signal is an edge, the counter is never read */
+
+        const int event_fd = eventfd(0U, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        struct mg_connection *conn = event_fd >= 0 ? mg_wrapfd(&mgr, event_fd, uring_wakeup_handler, NULL) : NULL;
+
+        if(conn != NULL)
+        {
+            struct epoll_event ev = {EPOLLIN | EPOLLET, {conn}};
+
+            epoll_ctl(mgr.epoll_fd, EPOLL_CTL_MOD, event_fd, &ev);
+        }
+
+        if(conn != NULL && nyx_uring_recv_init(event_fd, ingest_ring_handler))
+        {
+            ingest_uring = true;
+
+            MG_INFO(("Using io_uring for ingest"));
+        }
+        else
+        {
+            if(conn != NULL) {
+                conn->is_closing = 1;
+            }
+            else if(event_fd >= 0) {
+                close(event_fd);
+            }
+
+            MG_ERROR(("io_uring ingest not available, falling back to epoll"));
+        }
+    }
+
+    if(ZEROCOPY > 0U)
+    {
+        if(nyx_uring_enabled()) {
+            MG_INFO(("Zero-copy raw egress from %u bytes", ZEROCOPY));
+        }
+        else {
+            MG_ERROR(("Zero-copy needs io_uring (`--io-uring`), copying instead"));
+        }
+    }
 
-    mg_timer_add(&mgr, KEEPALIVE_MS, MG_TIMER_REPEAT | MG_TIMER_RUN_NOW, keepalive_timer_handler, &mgr);
+    /*----------------------------------------------------------------------------------------------------------------*/
 
     mg_timer_add(&mgr, RETRY_MS, MG_TIMER_REPEAT | MG_TIMER_RUN_NOW, retry_timer_handler, &mgr);
 
@@ -757,18 +6110,138 @@ int main(const int argc, str_t *argv)
 
     /*----------------------------------------------------------------------------------------------------------------*/
 
+    if(UPSTREAM[0] != '\0')
+    {
+        nyx_timer_init(&upstream_timer, upstream_timer_handler, &mgr);
+
+        nyx_wheel_schedule(&wheel, &upstream_timer, mg_millis());
+    }
+
+    if(DEDUP)
+    {
+        nyx_pool_add_stage("dedup", dedup_stage, NULL, POOL_QUEUE_SIZE, true);
+    }
+
+    if(nyx_pool_stages() > 0U)
+    {
+        /* The wakeup connection is the most recent one */
+
+        if(mg_wakeup_init(&mgr))
+        {
+            wakeup_id = mgr.conns->id;
+        }
+
+        nyx_pool_start(WORKERS, pool_wakeup, &mgr);
+
+        MG_INFO(("Frame pipeline with %lu stage(s) on %lu worker(s)", (unsigned long) nyx_pool_stages(), (unsigned long) nyx_pool_workers()));
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(CLUSTER_NODE[0] != '\0')
+    {
+        nyx_timer_init(&cluster_timer, cluster_timer_handler, &mgr);
+
+        nyx_wheel_schedule(&wheel, &cluster_timer, mg_millis());
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    nyx_timer_init(&rate_timer, rate_timer_handler, NULL);
+
+    nyx_wheel_schedule(&wheel, &rate_timer, (rate_meter_ms = mg_millis()) + RATE_METER_MS);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    nyx_timer_init(&shed.timer, shed_timer_handler, NULL);
+
+    nyx_wheel_schedule(&wheel, &shed.timer, mg_millis() + SHED_SAMPLE_MS);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Started by a previous instance, take over its sockets before listening */
+
+    const int handoff_sock = nyx_handoff_attach();
+
+    if(handoff_sock >= 0)
+    {
+        const bool adopted = adopt(&mgr, handoff_sock);
+
+        close(handoff_sock);
+
+        if(adopted == false)
+        {
+            MG_ERROR(("Handoff failed, the previous process keeps on serving"));
+
+            mg_mgr_free(&mgr);
+
+            return 1;
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    signal(SIGUSR2, signal_handler);
 
-    while(s_signo == 0)
+    for(uint64_t start = mg_millis(); s_signo == 0;)
     {
-        mg_mgr_poll(&mgr, (int) POLL_MS);
+        /* Deferred ingest work must not wait for the poll timeout */
+
+        ingest_round++;
+
+        mg_mgr_poll(&mgr, ingest_deferred > 0U ? 0 : (int) POLL_MS);
+
+        nyx_uring_poll();
+
+        nyx_pool_drain(pool_handler);
+
+        const uint64_t now = mg_millis();
+
+        nyx_wheel_advance(&wheel, now);
+
+        flush_batches(now);
+
+        flush_raws(now);
+
+        flush_uring();
+
+        /* Idle iterations last about one poll interval, the rest is work */
+
+        const uint64_t end = mg_millis();
+
+        if(shed.iteration_max_ms < end - start)
+        {
+            shed.iteration_max_ms = end - start;
+        }
+
+        start = end;
+
+        if(s_handoff != 0)
+        {
+            s_handoff = 0;
+
+            if(handoff(&mgr))
+            {
+                break;
+            }
+        }
     }
 
     /*----------------------------------------------------------------------------------------------------------------*/
 
+    nyx_pool_stop();
+
     mg_mgr_free(&mgr);
 
+    nyx_recorder_stop();
+
+    nyx_uring_free();
+
+    mg_free((void *) tls_opts.cert.buf);
+    mg_free((void *) tls_opts.key.buf);
+
     /*----------------------------------------------------------------------------------------------------------------*/
 
     MG_INFO(("Bye."));
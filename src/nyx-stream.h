@@ -53,6 +53,30 @@ __NYX_INLINE__ uint32_t nyx_read_u32_le(const uint8_t *buff)
     ;
 }
 
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+__NYX_INLINE__ void nyx_write_u32_le(uint8_t *buff, uint32_t value)
+{
+    buff[0] = (uint8_t) (value >> 0);
+    buff[1] = (uint8_t) (value >> 8);
+    buff[2] = (uint8_t) (value >> 16);
+    buff[3] = (uint8_t) (value >> 24);
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* STREAM                                                                                                             */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#define STREAM_MAGIC 0x5358594EU
+
+#define STREAM_HEADER_SIZE (4U /* MAGIC */ + 4U /* HASH */ + 4U /* SIZE */)
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#define FRAGMENT_MAGIC 0x4658594EU
+
+#define FRAGMENT_HEADER_SIZE (4U /* MAGIC */ + 4U /* HASH */ + 4U /* SIZE */ + 4U /* OFFSET */ + 4U /* TOTAL */)
+
 /*--------------------------------------------------------------------------------------------------------------------*/
 /* MEM                                                                                                                */
 /*--------------------------------------------------------------------------------------------------------------------*/
@@ -63,12 +87,302 @@ buff_t nyx_memory_alloc(__NYX_ZEROABLE__ size_t size);
 
 buff_t nyx_memory_realloc(__NYX_NULLABLE__ buff_t buff, __NYX_ZEROABLE__ size_t size);
 
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_buffer
+{
+    buff_t buf;
+    size_t len;
+    size_t size;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_buffer_append(__NYX_NOTNULL__ struct nyx_buffer *buffer, __NYX_NULLABLE__ BUFF_t data, __NYX_ZEROABLE__ size_t size);
+
+void nyx_buffer_free(__NYX_NOTNULL__ struct nyx_buffer *buffer);
+
 /*--------------------------------------------------------------------------------------------------------------------*/
 /* HASH                                                                                                               */
 /*--------------------------------------------------------------------------------------------------------------------*/
 
 uint32_t nyx_hash(__NYX_ZEROABLE__ size_t size, __NYX_NULLABLE__ BUFF_t buff, uint32_t seed);
 
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* FRAME                                                                                                              */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_frame
+{
+    uint32_t refs;
+
+    uint32_t hash;
+
+    uint64_t ingest_ms;
+
+    size_t size;
+
+    uint8_t data[];
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_frame *nyx_frame_new(uint32_t hash, uint64_t ingest_ms, __NYX_ZEROABLE__ size_t size, __NYX_NULLABLE__ BUFF_t data);
+
+struct nyx_frame *nyx_frame_retain(__NYX_NOTNULL__ struct nyx_frame *frame);
+
+void nyx_frame_release(__NYX_NULLABLE__ struct nyx_frame *frame);
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_fifo
+{
+    struct nyx_frame **frames;
+
+    size_t head;
+    size_t len;
+    size_t cap;
+
+    size_t bytes;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_fifo_push(__NYX_NOTNULL__ struct nyx_fifo *fifo, __NYX_NOTNULL__ struct nyx_frame *frame);
+
+struct nyx_frame *nyx_fifo_peek(__NYX_NOTNULL__ const struct nyx_fifo *fifo);
+
+struct nyx_frame *nyx_fifo_at(__NYX_NOTNULL__ const struct nyx_fifo *fifo, size_t idx);
+
+struct nyx_frame *nyx_fifo_pop(__NYX_NOTNULL__ struct nyx_fifo *fifo);
+
+void nyx_fifo_clear(__NYX_NOTNULL__ struct nyx_fifo *fifo);
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* WHEEL                                                                                                              */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#define NYX_WHEEL_BITS 6U
+
+#define NYX_WHEEL_LEVELS 4U
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_timer
+{
+    uint64_t deadline_ms;
+
+    void (* callback)(void *arg);
+
+    void *arg;
+
+    struct nyx_timer *next;
+    struct nyx_timer **pprev;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_wheel
+{
+    uint64_t now_ms;
+
+    size_t count;
+
+    struct nyx_timer *expired;
+
+    struct nyx_timer *slots[NYX_WHEEL_LEVELS][1U << NYX_WHEEL_BITS];
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+__NYX_INLINE__ bool nyx_timer_pending(const struct nyx_timer *timer)
+{
+    return timer->pprev != NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_timer_init(__NYX_NOTNULL__ struct nyx_timer *timer, __NYX_NOTNULL__ void (* callback)(void *arg), __NYX_NULLABLE__ void *arg);
+
+void nyx_wheel_init(__NYX_NOTNULL__ struct nyx_wheel *wheel, uint64_t now_ms);
+
+void nyx_wheel_schedule(__NYX_NOTNULL__ struct nyx_wheel *wheel, __NYX_NOTNULL__ struct nyx_timer *timer, uint64_t deadline_ms);
+
+void nyx_wheel_cancel(__NYX_NOTNULL__ struct nyx_wheel *wheel, __NYX_NOTNULL__ struct nyx_timer *timer);
+
+void nyx_wheel_advance(__NYX_NOTNULL__ struct nyx_wheel *wheel, uint64_t now_ms);
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* RING                                                                                                               */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#define NYX_RING_VNODES 64U
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_ring_point
+{
+    uint32_t point;
+
+    STR_t name;
+
+    void *owner;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_ring
+{
+    size_t cnt;
+
+    struct nyx_ring_point *points;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_ring_init(__NYX_NOTNULL__ struct nyx_ring *ring);
+
+void nyx_ring_clear(__NYX_NOTNULL__ struct nyx_ring *ring);
+
+/* The name must outlive the ring, the owner is returned as is by lookups */
+
+void nyx_ring_add(__NYX_NOTNULL__ struct nyx_ring *ring, __NYX_NOTNULL__ STR_t name, __NYX_NULLABLE__ void *owner);
+
+void *nyx_ring_lookup(__NYX_NOTNULL__ const struct nyx_ring *ring, uint32_t hash);
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* IMAGE                                                                                                              */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#define NYX_PIXEL_U8 0U
+#define NYX_PIXEL_U16 1U
+#define NYX_PIXEL_U32 2U
+#define NYX_PIXEL_F32 3U
+
+#define NYX_IMAGE_MAX_BIN 64U
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+/* Returns 0 for an unknown pixel type */
+
+size_t nyx_pixel_size(uint32_t type);
+
+/* Crops the (x, y, w, h) rectangle and averages each bin x bin block, w and h must be multiples of bin */
+
+void nyx_image_view(uint32_t type, __NYX_NOTNULL__ BUFF_t src, uint32_t src_width, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t bin, __NYX_NOTNULL__ buff_t dst);
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* RECORDER                                                                                                           */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_recorder_start(__NYX_NOTNULL__ STR_t path);
+
+void nyx_recorder_stop(void);
+
+bool nyx_recorder_push(uint32_t hash, uint64_t time_ms, __NYX_ZEROABLE__ size_t size, __NYX_NOTNULL__ BUFF_t frame);
+
+size_t nyx_recorder_dropped(void);
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_cursor *nyx_cursor_open(__NYX_NOTNULL__ STR_t path, uint32_t hash, uint64_t from_ms, uint64_t to_ms);
+
+/* The returned frame is memory-mapped and only valid until the next call */
+
+bool nyx_cursor_next(__NYX_NOTNULL__ struct nyx_cursor *cursor, __NYX_NOTNULL__ uint64_t *time_ms, __NYX_NOTNULL__ size_t *size, __NYX_NOTNULL__ BUFF_t *frame);
+
+void nyx_cursor_close(__NYX_NULLABLE__ struct nyx_cursor *cursor);
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* POOL                                                                                                               */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#define NYX_POOL_MAX_STAGES 8U
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_pool_add_stage(__NYX_NOTNULL__ STR_t name, __NYX_NOTNULL__ struct nyx_frame *(* process)(struct nyx_frame *frame, void *arg), __NYX_NULLABLE__ void *arg, size_t limit, bool drop_oldest);
+
+bool nyx_pool_start(__NYX_ZEROABLE__ size_t workers, __NYX_NULLABLE__ void (* wakeup)(void *arg), __NYX_NULLABLE__ void *arg);
+
+void nyx_pool_stop(void);
+
+bool nyx_pool_enabled(void);
+
+void nyx_pool_push(__NYX_NOTNULL__ struct nyx_frame *frame);
+
+size_t nyx_pool_drain(__NYX_NOTNULL__ void (* callback)(struct nyx_frame *frame));
+
+size_t nyx_pool_workers(void);
+
+size_t nyx_pool_stages(void);
+
+void nyx_pool_stats(size_t idx, __NYX_NOTNULL__ STR_t *name, __NYX_NOTNULL__ size_t *depth, __NYX_NOTNULL__ size_t *limit, __NYX_NOTNULL__ uint64_t *processed, __NYX_NOTNULL__ uint64_t *filtered, __NYX_NOTNULL__ uint64_t *dropped, __NYX_NOTNULL__ uint64_t *avg_us, __NYX_NOTNULL__ uint64_t *max_us);
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* URING                                                                                                              */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_init(unsigned entries);
+
+void nyx_uring_free(void);
+
+void nyx_uring_disable(void);
+
+bool nyx_uring_enabled(void);
+
+bool nyx_uring_send(int fd, __NYX_NOTNULL__ BUFF_t buff, __NYX_ZEROABLE__ size_t size, uint64_t user_data);
+
+size_t nyx_uring_submit(__NYX_NOTNULL__ void (* callback)(uint64_t user_data, int32_t result));
+
+/* Zero-copy send, returns the bytes sent or -errno, the frame stays pinned until the kernel releases its pages */
+
+int32_t nyx_uring_send_zc(int fd, __NYX_NOTNULL__ struct nyx_frame *frame, size_t offset);
+
+/* Multishot receives into registered buffers, the event is signaled when they complete and user_data < 2^62 */
+
+bool nyx_uring_recv_init(int event_fd, __NYX_NOTNULL__ void (* callback)(uint64_t user_data, __NYX_NULLABLE__ BUFF_t buff, int32_t result, bool more));
+
+bool nyx_uring_recv_enabled(void);
+
+bool nyx_uring_recv(int fd, uint64_t user_data);
+
+bool nyx_uring_recv_cancel(uint64_t user_data);
+
+size_t nyx_uring_poll(void);
+
+void nyx_uring_stats(__NYX_NOTNULL__ uint64_t *enters, __NYX_NOTNULL__ uint64_t *sends);
+
+void nyx_uring_zc_stats(__NYX_NOTNULL__ uint64_t *sends, __NYX_NOTNULL__ uint64_t *bytes, __NYX_NOTNULL__ uint64_t *copied, __NYX_NOTNULL__ uint64_t *pinned);
+
+void nyx_uring_recv_stats(__NYX_NOTNULL__ uint64_t *recvs, __NYX_NOTNULL__ uint64_t *bytes, __NYX_NOTNULL__ uint64_t *nobufs);
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* KTLS                                                                                                               */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct mg_connection;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_ktls_init(__NYX_NOTNULL__ struct mg_connection *conn);
+
+bool nyx_ktls_enabled(__NYX_NOTNULL__ const struct mg_connection *conn);
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* HANDOFF                                                                                                            */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+int nyx_handoff_spawn(__NYX_NOTNULL__ str_t *argv, __NYX_NOTNULL__ int *pid);
+
+void nyx_handoff_abort(int sock, int pid);
+
+int nyx_handoff_attach(void);
+
+bool nyx_handoff_send(int sock, int fd, __NYX_NOTNULL__ BUFF_t buff, __NYX_ZEROABLE__ size_t size);
+
+bool nyx_handoff_recv(int sock, __NYX_NULLABLE__ int *fd, __NYX_NOTNULL__ buff_t buff, __NYX_ZEROABLE__ size_t size);
+
 /*--------------------------------------------------------------------------------------------------------------------*/
 /* CONFIG                                                                                                             */
 /*--------------------------------------------------------------------------------------------------------------------*/
@@ -79,7 +393,21 @@ bool nyx_load_config(
     str_t *mqtt_url,
     str_t *mqtt_username,
     str_t *mqtt_password,
-    str_t *poll_ms
+    str_t *poll_ms,
+    str_t *record,
+    str_t *record_dir,
+    str_t *tls_cert,
+    str_t *tls_key,
+    str_t *upstream,
+    str_t *shed_lag_ms,
+    str_t *sub_url,
+    str_t *stream_bps,
+    str_t *addr_bps,
+    str_t *cluster_node,
+    str_t *cluster,
+    str_t *zerocopy,
+    str_t *images,
+    str_t *admit
 );
 
 /*--------------------------------------------------------------------------------------------------------------------*/
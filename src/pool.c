@@ -0,0 +1,588 @@
+/* NyxStream
+ * Author: Jérôme ODIER <jerome.odier@lpsc.in2p3.fr>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#include <time.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "nyx-stream.h"
+
+#include "external/mongoose.h"
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct job
+{
+    struct nyx_frame *frame;
+
+    size_t stage;
+
+    struct job *next;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct stage
+{
+    STR_t name;
+
+    struct nyx_frame *(* process)(struct nyx_frame *frame, void *arg);
+
+    void *arg;
+
+    size_t limit;
+
+    bool drop_oldest;
+
+    size_t depth;
+
+    uint64_t processed;
+    uint64_t filtered;
+    uint64_t dropped;
+    uint64_t time_ns;
+    uint64_t max_ns;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct worker
+{
+    pthread_t thread;
+
+    pthread_mutex_t mutex;
+
+    pthread_cond_t cond;
+
+    bool running;
+
+    struct job *head;
+    struct job *tail;
+
+    size_t depth[NYX_POOL_MAX_STAGES];
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t s_stage_cnt = 0U;
+
+static struct stage s_stages[NYX_POOL_MAX_STAGES];
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t s_worker_cnt = 0U;
+
+static struct worker *s_workers = NULL;
+
+static bool s_running = false;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct job *s_done_head = NULL;
+static struct job *s_done_tail = NULL;
+
+static pthread_mutex_t s_done_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void (* s_wakeup)(void *arg) = NULL;
+
+static void *s_wakeup_arg = NULL;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* WORKERS                                                                                                            */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _free_job(struct job *job)
+{
+    nyx_frame_release(job->frame);
+
+    nyx_memory_free(job);
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _complete(struct job *job)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    job->next = NULL;
+
+    pthread_mutex_lock(&s_done_mutex);
+
+    const bool was_empty = s_done_head == NULL;
+
+    if(s_done_tail != NULL) {
+        s_done_tail->next = job;
+    }
+    else {
+        s_done_head = job;
+    }
+
+    s_done_tail = job;
+
+    pthread_mutex_unlock(&s_done_mutex);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* One wakeup per batch, the loop takes the whole list at once */
+
+    if(was_empty && s_wakeup != NULL)
+    {
+        s_wakeup(s_wakeup_arg);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _enqueue(struct worker *worker, struct job *job)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct stage *stage = &s_stages[job->stage];
+
+    job->next = NULL;
+
+    pthread_mutex_lock(&worker->mutex);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* The limit applies to each worker queue, the stage depth is their sum */
+
+    if(worker->depth[job->stage] >= stage->limit)
+    {
+        struct job *victim = NULL;
+
+        if(stage->drop_oldest)
+        {
+            /* Live data, the oldest frame of the same stream is the least useful, other streams keep theirs */
+
+            for(struct job **pp = &worker->head, *prev = NULL; *pp != NULL; prev = *pp, pp = &(*pp)->next)
+            {
+                if((*pp)->stage == job->stage && (*pp)->frame->hash == job->frame->hash)
+                {
+                    victim = *pp; *pp = victim->next;
+
+                    if(worker->tail == victim)
+                    {
+                        worker->tail = prev;
+                    }
+
+                    __atomic_sub_fetch(&stage->depth, 1U, __ATOMIC_RELAXED);
+
+                    worker->depth[job->stage]--;
+
+                    break;
+                }
+            }
+        }
+
+        if(victim == NULL)
+        {
+            victim = job;
+
+            job = NULL;
+        }
+
+        __atomic_add_fetch(&stage->dropped, 1U, __ATOMIC_RELAXED);
+
+        _free_job(victim);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(job != NULL)
+    {
+        if(worker->tail != NULL) {
+            worker->tail->next = job;
+        }
+        else {
+            worker->head = job;
+        }
+
+        worker->tail = job;
+
+        __atomic_add_fetch(&stage->depth, 1U, __ATOMIC_RELAXED);
+
+        worker->depth[job->stage]++;
+
+        pthread_cond_signal(&worker->cond);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool _process(struct job *job)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct stage *stage = &s_stages[job->stage];
+
+    struct timespec t1;
+    struct timespec t2;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    job->frame = stage->process(job->frame, stage->arg);
+
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const uint64_t time_ns = (uint64_t) (t2.tv_sec - t1.tv_sec) * 1000000000U + (uint64_t) t2.tv_nsec - (uint64_t) t1.tv_nsec;
+
+    __atomic_add_fetch(&stage->processed, 1U, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&stage->time_ns, time_ns, __ATOMIC_RELAXED);
+
+    for(uint64_t max_ns = __atomic_load_n(&stage->max_ns, __ATOMIC_RELAXED); max_ns < time_ns;)
+    {
+        if(__atomic_compare_exchange_n(&stage->max_ns, &max_ns, time_ns, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* A stage returns NULL to filter the frame out */
+
+    if(job->frame == NULL)
+    {
+        __atomic_add_fetch(&stage->filtered, 1U, __ATOMIC_RELAXED);
+
+        return false;
+    }
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void *_worker(void *arg)
+{
+    struct worker *worker = arg;
+
+    for(;;)
+    {
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        pthread_mutex_lock(&worker->mutex);
+
+        while(worker->running && worker->head == NULL)
+        {
+            pthread_cond_wait(&worker->cond, &worker->mutex);
+        }
+
+        struct job *job = worker->head;
+
+        if(job == NULL)
+        {
+            pthread_mutex_unlock(&worker->mutex);
+
+            break;
+        }
+
+        worker->head = job->next;
+
+        if(worker->head == NULL)
+        {
+            worker->tail = NULL;
+        }
+
+        __atomic_sub_fetch(&s_stages[job->stage].depth, 1U, __ATOMIC_RELAXED);
+
+        worker->depth[job->stage]--;
+
+        pthread_mutex_unlock(&worker->mutex);
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        if(_process(job) == false)
+        {
+            _free_job(job);
+        }
+        else if(job->stage + 1U < s_stage_cnt)
+        {
+            /* Same worker for the next stage, frames of a stream stay in order */
+
+            job->stage++;
+
+            _enqueue(worker, job);
+        }
+        else
+        {
+            _complete(job);
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+    }
+
+    return NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* POOL                                                                                                               */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_pool_add_stage(STR_t name, struct nyx_frame *(* process)(struct nyx_frame *frame, void *arg), void *arg, size_t limit, bool drop_oldest)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_running || s_stage_cnt == NYX_POOL_MAX_STAGES)
+    {
+        return false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct stage *stage = &s_stages[s_stage_cnt++];
+
+    memset(stage, 0x00, sizeof(struct stage));
+
+    stage->name = name;
+    stage->process = process;
+    stage->arg = arg;
+    stage->limit = limit > 0U ? limit : 1U;
+    stage->drop_oldest = drop_oldest;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_pool_start(size_t workers, void (* wakeup)(void *arg), void *arg)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_running || s_stage_cnt == 0U)
+    {
+        return false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    s_wakeup = wakeup;
+    s_wakeup_arg = arg;
+
+    s_workers = nyx_memory_alloc(workers * sizeof(struct worker));
+
+    s_running = true;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(s_worker_cnt = 0U; s_worker_cnt < workers; s_worker_cnt++)
+    {
+        struct worker *worker = &s_workers[s_worker_cnt];
+
+        memset(worker, 0x00, sizeof(struct worker));
+
+        worker->running = true;
+
+        pthread_mutex_init(&worker->mutex, NULL);
+
+        pthread_cond_init(&worker->cond, NULL);
+
+        if(pthread_create(&worker->thread, NULL, _worker, worker) != 0)
+        {
+            MG_ERROR(("Cannot start worker thread %lu", (unsigned long) s_worker_cnt));
+
+            pthread_cond_destroy(&worker->cond);
+
+            pthread_mutex_destroy(&worker->mutex);
+
+            break;
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_pool_stop(void)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_running == false)
+    {
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Workers finish their queued jobs before leaving */
+
+    for(size_t i = 0U; i < s_worker_cnt; i++)
+    {
+        pthread_mutex_lock(&s_workers[i].mutex);
+
+        s_workers[i].running = false;
+
+        pthread_cond_signal(&s_workers[i].cond);
+
+        pthread_mutex_unlock(&s_workers[i].mutex);
+    }
+
+    s_running = false;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(size_t i = 0U; i < s_worker_cnt; i++)
+    {
+        struct worker *worker = &s_workers[i];
+
+        pthread_join(worker->thread, NULL);
+
+        pthread_cond_destroy(&worker->cond);
+
+        pthread_mutex_destroy(&worker->mutex);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(struct job *job = s_done_head, *next; job != NULL; job = next)
+    {
+        next = job->next;
+
+        _free_job(job);
+    }
+
+    s_done_head = s_done_tail = NULL;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    nyx_memory_free(s_workers);
+
+    s_workers = NULL;
+
+    s_worker_cnt = 0U;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_pool_enabled(void)
+{
+    return s_running;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_pool_push(struct nyx_frame *frame)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct job *job = nyx_memory_alloc(sizeof(struct job));
+
+    job->frame = frame;
+    job->stage = 0U;
+    job->next = NULL;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_worker_cnt > 0U)
+    {
+        /* A stream always goes to the same worker */
+
+        _enqueue(&s_workers[frame->hash % s_worker_cnt], job);
+
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* No thread, the stages run inline */
+
+    for(; job->stage < s_stage_cnt; job->stage++)
+    {
+        if(_process(job) == false)
+        {
+            _free_job(job);
+
+            return;
+        }
+    }
+
+    _complete(job);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+size_t nyx_pool_drain(void (* callback)(struct nyx_frame *frame))
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    pthread_mutex_lock(&s_done_mutex);
+
+    struct job *head = s_done_head;
+
+    s_done_head = s_done_tail = NULL;
+
+    pthread_mutex_unlock(&s_done_mutex);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    size_t result = 0U;
+
+    for(struct job *job = head, *next; job != NULL; job = next, result++)
+    {
+        next = job->next;
+
+        callback(job->frame);
+
+        _free_job(job);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+size_t nyx_pool_workers(void)
+{
+    return s_worker_cnt;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+size_t nyx_pool_stages(void)
+{
+    return s_stage_cnt;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_pool_stats(size_t idx, STR_t *name, size_t *depth, size_t *limit, uint64_t *processed, uint64_t *filtered, uint64_t *dropped, uint64_t *avg_us, uint64_t *max_us)
+{
+    const struct stage *stage = &s_stages[idx];
+
+    const uint64_t count = __atomic_load_n(&stage->processed, __ATOMIC_RELAXED);
+
+    *name = stage->name;
+    *depth = __atomic_load_n(&stage->depth, __ATOMIC_RELAXED);
+    *limit = stage->limit;
+    *processed = count;
+    *filtered = __atomic_load_n(&stage->filtered, __ATOMIC_RELAXED);
+    *dropped = __atomic_load_n(&stage->dropped, __ATOMIC_RELAXED);
+    *avg_us = count > 0U ? __atomic_load_n(&stage->time_ns, __ATOMIC_RELAXED) / count / 1000U : 0U;
+    *max_us = __atomic_load_n(&stage->max_ns, __ATOMIC_RELAXED) / 1000U;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,820 @@
+/* NyxStream
+ * Author: Jérôme ODIER <jerome.odier@lpsc.in2p3.fr>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "nyx-stream.h"
+
+#include "external/mongoose.h"
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#define SEGMENT_SIZE (256U * 1024U * 1024U)
+
+#define MAX_PENDING (64U * 1024U * 1024U)
+
+#define MAX_IOV 1024U
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct record
+{
+    uint32_t hash;
+    uint32_t size;
+    uint64_t time_ms;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct entry
+{
+    uint64_t time_ms;
+    uint64_t seq;
+    uint64_t offset;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct track
+{
+    uint32_t hash;
+
+    int seg_fd;
+    int idx_fd;
+
+    uint64_t seq;
+    uint64_t offset;
+    uint64_t flushed;
+
+    size_t iov_cnt;
+    struct iovec iov[MAX_IOV];
+
+    struct nyx_buffer entries;
+
+    struct track *next;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static str_t s_path = NULL;
+
+static struct track *s_tracks = NULL;
+
+static struct nyx_buffer s_pending = {NULL, 0, 0};
+
+static size_t s_dropped = 0;
+
+static bool s_running = false;
+
+static pthread_t s_thread;
+
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_cond_t s_cond = PTHREAD_COND_INITIALIZER;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* WRITER                                                                                                             */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool _write_all(int fd, struct iovec *iov, size_t cnt)
+{
+    while(cnt > 0U)
+    {
+        const ssize_t n = writev(fd, iov, (int) cnt);
+
+        if(n <= 0)
+        {
+            if(n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        /* Short write, skip what went out and retry the rest */
+
+        size_t done = (size_t) n;
+
+        for(; cnt > 0U && done >= iov->iov_len; iov++, cnt--)
+        {
+            done -= iov->iov_len;
+        }
+
+        if(cnt > 0U)
+        {
+            iov->iov_base = (uint8_t *) iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _drop_segment(struct track *track)
+{
+    if(track->seg_fd >= 0) {
+        close(track->seg_fd);
+        track->seg_fd = -1;
+    }
+
+    if(track->idx_fd >= 0) {
+        close(track->idx_fd);
+        track->idx_fd = -1;
+    }
+
+    track->iov_cnt = 0U;
+
+    track->entries.len = 0U;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _flush_track(struct track *track)
+{
+    struct stat st;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(track->iov_cnt > 0U)
+    {
+        if(_write_all(track->seg_fd, track->iov, track->iov_cnt) == false)
+        {
+            MG_ERROR(("Cannot write segment of stream %08X (errno %d), %lu frames lost", track->hash, errno, (unsigned long) (track->entries.len / sizeof(struct entry))));
+
+            /* Back to the last complete frame, the entries of the lost ones are never written */
+
+            /**/ if(ftruncate(track->seg_fd, (off_t) track->flushed) == 0)
+            {
+                track->offset = track->flushed;
+            }
+            else if(fstat(track->seg_fd, &st) == 0)
+            {
+                track->offset = track->flushed = (uint64_t) st.st_size;
+            }
+            else
+            {
+                _drop_segment(track);
+
+                return;
+            }
+
+            track->entries.len = 0U;
+        }
+        else
+        {
+            track->flushed = track->offset;
+        }
+
+        track->iov_cnt = 0U;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Data first, so that readers never see an entry without its frame */
+
+    if(track->entries.len > 0U)
+    {
+        struct iovec iov = {track->entries.buf, track->entries.len};
+
+        if(_write_all(track->idx_fd, &iov, 1U) == false)
+        {
+            MG_ERROR(("Cannot write index of stream %08X (errno %d)", track->hash, errno));
+
+            /* A torn entry would shift all the following ones, the next frame starts a new segment otherwise */
+
+            if(fstat(track->idx_fd, &st) != 0 || ftruncate(track->idx_fd, st.st_size - st.st_size % (off_t) sizeof(struct entry)) != 0)
+            {
+                _drop_segment(track);
+
+                return;
+            }
+        }
+
+        track->entries.len = 0U;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _close_segment(struct track *track)
+{
+    _flush_track(track);
+
+    _drop_segment(track);
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool _open_segment(struct track *track, uint64_t time_ms)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/%08X", s_path, track->hash);
+
+    mkdir(path, 0755);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    snprintf(path, sizeof(path), "%s/%08X/%016llu.seg", s_path, track->hash, (unsigned long long) time_ms);
+
+    track->seg_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    snprintf(path, sizeof(path), "%s/%08X/%016llu.idx", s_path, track->hash, (unsigned long long) time_ms);
+
+    track->idx_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(track->seg_fd < 0 || track->idx_fd < 0)
+    {
+        MG_ERROR(("Cannot open segment `%s`", path));
+
+        _close_segment(track);
+
+        return false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Reserve the blocks up front, the file size still grows with the data */
+
+    if(fallocate(track->seg_fd, FALLOC_FL_KEEP_SIZE, 0, SEGMENT_SIZE) != 0)
+    {
+        MG_ERROR(("Cannot reserve segment of stream %08X (errno %d)", track->hash, errno));
+    }
+
+    /* Appending to an existing segment, after an error in the same millisecond */
+
+    struct stat st;
+
+    track->offset = track->flushed = fstat(track->seg_fd, &st) == 0 ? (uint64_t) st.st_size : 0x00;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct track *_get_track(uint32_t hash)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(struct track *track = s_tracks; track != NULL; track = track->next)
+    {
+        if(track->hash == hash)
+        {
+            return track;
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct track *track = nyx_memory_alloc(sizeof(struct track));
+
+    memset(track, 0x00, sizeof(struct track));
+
+    track->hash = hash;
+    track->seg_fd = -1;
+    track->idx_fd = -1;
+
+    track->next = s_tracks;
+
+    s_tracks = track;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return track;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _write_record(const struct record *record, const uint8_t *data)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct track *track = _get_track(record->hash);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(track->iov_cnt == MAX_IOV)
+    {
+        _flush_track(track);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(track->seg_fd >= 0 && track->offset + record->size > SEGMENT_SIZE && track->offset > 0x00)
+    {
+        _close_segment(track);
+    }
+
+    if(track->seg_fd < 0 && _open_segment(track, record->time_ms) == false)
+    {
+        return;
+    }
+
+    track->iov[track->iov_cnt].iov_base = (buff_t) data;
+    track->iov[track->iov_cnt].iov_len = record->size;
+    track->iov_cnt++;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const struct entry entry = {
+        .time_ms = record->time_ms,
+        .seq = track->seq++,
+        .offset = track->offset,
+    };
+
+    nyx_buffer_append(&track->entries, &entry, sizeof(entry));
+
+    track->offset += record->size;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void *_writer(__NYX_UNUSED__ void *arg)
+{
+    struct nyx_buffer batch = {NULL, 0, 0};
+
+    for(bool running = true; running;)
+    {
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* SWAP BUFFERS                                                                                               */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        pthread_mutex_lock(&s_mutex);
+
+        while(s_running && s_pending.len == 0U)
+        {
+            pthread_cond_wait(&s_cond, &s_mutex);
+        }
+
+        const struct nyx_buffer tmp = batch;
+        batch = s_pending;
+        s_pending = tmp;
+
+        running = s_running;
+
+        pthread_mutex_unlock(&s_mutex);
+
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* WRITE BATCH                                                                                                */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        for(size_t off = 0U; off + sizeof(struct record) <= batch.len;)
+        {
+            struct record record;
+
+            memcpy(&record, (uint8_t *) batch.buf + off, sizeof(struct record));
+
+            _write_record(&record, (uint8_t *) batch.buf + off + sizeof(struct record));
+
+            off += sizeof(struct record) + record.size;
+        }
+
+        for(struct track *track = s_tracks; track != NULL; track = track->next)
+        {
+            _flush_track(track);
+        }
+
+        batch.len = 0U;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+    }
+
+    nyx_buffer_free(&batch);
+
+    return NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* RECORDER                                                                                                           */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_recorder_start(STR_t path)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    mkdir(path, 0755);
+
+    s_path = strdup(path);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    s_running = true;
+
+    if(pthread_create(&s_thread, NULL, _writer, NULL) != 0)
+    {
+        MG_ERROR(("Cannot start recorder"));
+
+        s_running = false;
+
+        return false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    MG_INFO(("Recording to `%s`", path));
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_recorder_stop(void)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_running == false)
+    {
+        return;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    pthread_mutex_lock(&s_mutex);
+    s_running = false;
+    pthread_cond_signal(&s_cond);
+    pthread_mutex_unlock(&s_mutex);
+
+    pthread_join(s_thread, NULL);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(struct track *track = s_tracks, *next; track != NULL; track = next)
+    {
+        next = track->next;
+
+        _close_segment(track);
+
+        nyx_buffer_free(&track->entries);
+
+        nyx_memory_free(track);
+    }
+
+    s_tracks = NULL;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    nyx_buffer_free(&s_pending);
+
+    free(s_path);
+
+    s_path = NULL;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_recorder_push(uint32_t hash, uint64_t time_ms, size_t size, BUFF_t frame)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const struct record record = {
+        .hash = hash,
+        .size = (uint32_t) size,
+        .time_ms = time_ms,
+    };
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    pthread_mutex_lock(&s_mutex);
+
+    const bool result = s_running && s_pending.len + sizeof(struct record) + size <= MAX_PENDING;
+
+    if(result)
+    {
+        nyx_buffer_append(&s_pending, &record, sizeof(struct record));
+        nyx_buffer_append(&s_pending, frame, size);
+
+        pthread_cond_signal(&s_cond);
+    }
+    else
+    {
+        s_dropped++;
+    }
+
+    pthread_mutex_unlock(&s_mutex);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+size_t nyx_recorder_dropped(void)
+{
+    pthread_mutex_lock(&s_mutex);
+
+    const size_t result = s_dropped;
+
+    pthread_mutex_unlock(&s_mutex);
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+/* CURSOR                                                                                                             */
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_cursor
+{
+    str_t path;
+
+    uint64_t from_ms;
+    uint64_t to_ms;
+
+    size_t seg_cnt;
+    size_t seg_cur;
+    uint64_t *segs;
+
+    size_t entry_cnt;
+    size_t entry_cur;
+    const struct entry *entries;
+    size_t idx_size;
+
+    const uint8_t *data;
+    size_t data_size;
+};
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static int _cmp_u64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _unmap(struct nyx_cursor *cursor)
+{
+    if(cursor->entries != NULL) {
+        munmap((buff_t) cursor->entries, cursor->idx_size);
+        cursor->entries = NULL;
+    }
+
+    if(cursor->data != NULL) {
+        munmap((buff_t) cursor->data, cursor->data_size);
+        cursor->data = NULL;
+    }
+
+    cursor->entry_cnt = 0x00;
+    cursor->entry_cur = 0x00;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static const void *_map(const char *path, size_t *size)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0)
+    {
+        return NULL;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct stat st;
+
+    void *result = NULL;
+
+    if(fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        result = mmap(NULL, *size = (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if(result == MAP_FAILED)
+        {
+            result = NULL;
+        }
+    }
+
+    close(fd);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static bool _map_segment(struct nyx_cursor *cursor)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/%016llu.idx", cursor->path, (unsigned long long) cursor->segs[cursor->seg_cur]);
+
+    cursor->entries = _map(path, &cursor->idx_size);
+
+    snprintf(path, sizeof(path), "%s/%016llu.seg", cursor->path, (unsigned long long) cursor->segs[cursor->seg_cur]);
+
+    cursor->data = _map(path, &cursor->data_size);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(cursor->entries == NULL || cursor->data == NULL)
+    {
+        _unmap(cursor);
+
+        return false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    cursor->entry_cnt = cursor->idx_size / sizeof(struct entry);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    size_t lo = 0x00;
+    size_t hi = cursor->entry_cnt;
+
+    while(lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2U;
+
+        if(cursor->entries[mid].time_ms < cursor->from_ms) {
+            lo = mid + 1U;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    cursor->entry_cur = lo;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct nyx_cursor *nyx_cursor_open(STR_t path, uint32_t hash, uint64_t from_ms, uint64_t to_ms)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    char dir_path[4096];
+
+    snprintf(dir_path, sizeof(dir_path), "%s/%08X", path, hash);
+
+    DIR *dir = opendir(dir_path);
+
+    if(dir == NULL)
+    {
+        return NULL;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct nyx_cursor *result = nyx_memory_alloc(sizeof(struct nyx_cursor));
+
+    memset(result, 0x00, sizeof(struct nyx_cursor));
+
+    result->path = strdup(dir_path);
+    result->from_ms = from_ms;
+    result->to_ms = to_ms;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    for(struct dirent *dirent; (dirent = readdir(dir)) != NULL;)
+    {
+        unsigned long long time_ms;
+
+        char ext[8];
+
+        if(sscanf(dirent->d_name, "%llu.%7s", &time_ms, ext) == 2 && strcmp(ext, "idx") == 0)
+        {
+            result->segs = nyx_memory_realloc(result->segs, (result->seg_cnt + 1U) * sizeof(uint64_t));
+
+            result->segs[result->seg_cnt++] = (uint64_t) time_ms;
+        }
+    }
+
+    closedir(dir);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(result->seg_cnt > 0U)
+    {
+        qsort(result->segs, result->seg_cnt, sizeof(uint64_t), _cmp_u64);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Skip the segments ending before the requested range */
+
+    while(result->seg_cur + 1U < result->seg_cnt && result->segs[result->seg_cur + 1U] <= from_ms)
+    {
+        result->seg_cur++;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_cursor_next(struct nyx_cursor *cursor, uint64_t *time_ms, size_t *size, BUFF_t *frame)
+{
+    while(cursor->seg_cur < cursor->seg_cnt)
+    {
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        if(cursor->entries == NULL && _map_segment(cursor) == false)
+        {
+            cursor->seg_cur++;
+
+            continue;
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        if(cursor->entry_cur < cursor->entry_cnt)
+        {
+            const struct entry *entry = &cursor->entries[cursor->entry_cur];
+
+            if(entry->time_ms > cursor->to_ms)
+            {
+                break;
+            }
+
+            if(entry->offset + STREAM_HEADER_SIZE <= cursor->data_size)
+            {
+                const size_t frame_size = STREAM_HEADER_SIZE + nyx_read_u32_le(cursor->data + entry->offset + 8U);
+
+                if(entry->offset + frame_size <= cursor->data_size)
+                {
+                    cursor->entry_cur++;
+
+                    *time_ms = entry->time_ms;
+                    *size = frame_size;
+                    *frame = cursor->data + entry->offset;
+
+                    return true;
+                }
+            }
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        _unmap(cursor);
+
+        cursor->seg_cur++;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+    }
+
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_cursor_close(struct nyx_cursor *cursor)
+{
+    if(cursor != NULL)
+    {
+        _unmap(cursor);
+
+        nyx_memory_free(cursor->segs);
+
+        free(cursor->path);
+
+        nyx_memory_free(cursor);
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
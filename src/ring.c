@@ -0,0 +1,115 @@
+/* NyxStream
+ * Author: Jérôme ODIER <jerome.odier@lpsc.in2p3.fr>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "nyx-stream.h"
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static int _compare(const void *a, const void *b)
+{
+    const struct nyx_ring_point *pa = a;
+    const struct nyx_ring_point *pb = b;
+
+    /* Equal points are ordered by member name, so every instance builds the same ring */
+
+    if(pa->point != pb->point)
+    {
+        return pa->point < pb->point ? -1 : 1;
+    }
+
+    return strcmp(pa->name, pb->name);
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_ring_init(struct nyx_ring *ring)
+{
+    ring->cnt = 0U;
+
+    ring->points = NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_ring_clear(struct nyx_ring *ring)
+{
+    nyx_memory_free(ring->points);
+
+    ring->cnt = 0U;
+
+    ring->points = NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_ring_add(struct nyx_ring *ring, STR_t name, void *owner)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    ring->points = nyx_memory_realloc(ring->points, (ring->cnt + NYX_RING_VNODES) * sizeof(struct nyx_ring_point));
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Each virtual node hashes the member name with its own seed */
+
+    const size_t name_len = strlen(name);
+
+    for(uint32_t i = 0U; i < NYX_RING_VNODES; i++)
+    {
+        struct nyx_ring_point *point = &ring->points[ring->cnt++];
+
+        point->point = nyx_hash(name_len, name, i);
+        point->name = name;
+        point->owner = owner;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    qsort(ring->points, ring->cnt, sizeof(struct nyx_ring_point), _compare);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void *nyx_ring_lookup(const struct nyx_ring *ring, uint32_t hash)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(ring->cnt == 0U)
+    {
+        return NULL;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* First point clockwise from the hash */
+
+    size_t lo = 0U;
+    size_t hi = ring->cnt;
+
+    while(lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2U;
+
+        if(ring->points[mid].point < hash) {
+            lo = mid + 1U;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return ring->points[lo < ring->cnt ? lo : 0U].owner;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,1056 @@
+/* NyxStream
+ * Author: Jérôme ODIER <jerome.odier@lpsc.in2p3.fr>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#include <errno.h>
+
+#include "nyx-stream.h"
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+#ifdef HAVE_IO_URING
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+/* Zero-copy sends, receives and cancellations are told apart from the caller's sends by the low bits of their user data */
+
+#define TAG_MASK 3ULL
+
+#define ZC_TAG 1ULL
+
+#define RECV_TAG 2ULL
+
+#define CANCEL_TAG 3ULL
+
+/* What each queued entry is, receives are not waited for */
+
+#define KIND_RECV 0U
+
+#define KIND_SEND 1U
+
+#define KIND_CANCEL 2U
+
+/* How long nyx_uring_free() waits for the pending zero-copy notifications */
+
+#define ZC_DRAIN_MS 1000U
+
+/* Buffers the kernel picks from for multishot receives, their number must be a power of two */
+
+#define RECV_GROUP 0U
+
+#define RECV_BUFFERS 32U
+
+#define RECV_BUFFER_SIZE 262144U
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+struct _zc_send
+{
+    struct nyx_frame *frame;
+
+    size_t size;
+
+    struct _zc_send *prev;
+    struct _zc_send *next;
+};
+
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static int s_fd = -1;
+
+static unsigned s_entries = 0U;
+
+static unsigned s_queued = 0U;
+
+static unsigned s_inflight = 0U;
+
+static unsigned s_queued_waits = 0U;
+
+static bool s_disabled = false;
+
+static void (* s_callback)(uint64_t user_data, int32_t result) = NULL;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static buff_t s_sq_ptr = NULL;
+static size_t s_sq_size = 0U;
+
+static buff_t s_cq_ptr = NULL;
+static size_t s_cq_size = 0U;
+
+static struct io_uring_sqe *s_sqes = NULL;
+static size_t s_sqes_size = 0U;
+
+static uint8_t *s_sq_kinds = NULL;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static unsigned *s_sq_tail = NULL;
+static unsigned *s_sq_mask = NULL;
+static unsigned *s_sq_array = NULL;
+
+static unsigned *s_cq_head = NULL;
+static unsigned *s_cq_tail = NULL;
+static unsigned *s_cq_mask = NULL;
+
+static struct io_uring_cqe *s_cqes = NULL;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static uint64_t s_enters = 0U;
+
+static uint64_t s_sends = 0U;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct _zc_send *s_zc_waiting = NULL;
+
+static struct _zc_send *s_zc_list = NULL;
+
+static int32_t s_zc_result = 0;
+
+static uint64_t s_zc_sends = 0U;
+
+static uint64_t s_zc_bytes = 0U;
+
+static uint64_t s_zc_copied = 0U;
+
+static uint64_t s_zc_pinned = 0U;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct io_uring_buf_ring *s_buf_ring = NULL;
+
+static uint16_t s_buf_tail = 0U;
+
+static uint8_t *s_recv_buffs = NULL;
+
+static void (* s_recv_callback)(uint64_t user_data, BUFF_t buff, int32_t result, bool more) = NULL;
+
+static uint64_t s_recvs = 0U;
+
+static uint64_t s_recv_bytes = 0U;
+
+static uint64_t s_recv_nobufs = 0U;
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct _zc_send *_zc_pin(struct nyx_frame *frame)
+{
+    struct _zc_send *zc = nyx_memory_alloc(sizeof(struct _zc_send));
+
+    zc->frame = nyx_frame_retain(frame);
+    zc->size = 0U;
+
+    zc->prev = NULL;
+    zc->next = s_zc_list;
+
+    if(s_zc_list != NULL) {
+        s_zc_list->prev = zc;
+    }
+
+    s_zc_list = zc;
+
+    s_zc_pinned++;
+
+    return zc;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _zc_unpin(struct _zc_send *zc)
+{
+    if(zc->prev != NULL) {
+        zc->prev->next = zc->next;
+    }
+    else {
+        s_zc_list = zc->next;
+    }
+
+    if(zc->next != NULL) {
+        zc->next->prev = zc->prev;
+    }
+
+    nyx_frame_release(zc->frame);
+
+    nyx_memory_free(zc);
+
+    s_zc_pinned--;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _zc_complete(const struct io_uring_cqe *cqe)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct _zc_send *zc = (struct _zc_send *) (uintptr_t) (cqe->user_data & ~ZC_TAG);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if((cqe->flags & IORING_CQE_F_NOTIF) != 0U)
+    {
+        /* The kernel is done with the pages, it may have copied them after all (e.g. loopback) */
+
+        if(((uint32_t) cqe->res & IORING_NOTIF_USAGE_ZC_COPIED) != 0U) {
+            s_zc_copied += zc->size;
+        }
+        else {
+            s_zc_bytes += zc->size;
+        }
+    }
+    else
+    {
+        if(zc == s_zc_waiting)
+        {
+            s_zc_waiting = NULL;
+
+            s_zc_result = cqe->res;
+        }
+
+        zc->size = cqe->res > 0 ? (size_t) cqe->res : 0U;
+
+        /* No notification follows a failed send */
+
+        if((cqe->flags & IORING_CQE_F_MORE) != 0U)
+        {
+            return;
+        }
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    _zc_unpin(zc);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _recv_recycle(uint16_t bid)
+{
+    /* Only the address, length and id fields are written, the ring tail overlays the first buffer's reserved one */
+
+    struct io_uring_buf *buf = &s_buf_ring->bufs[s_buf_tail & (RECV_BUFFERS - 1U)];
+
+    buf->addr = (uint64_t) (uintptr_t) (s_recv_buffs + (size_t) bid * RECV_BUFFER_SIZE);
+    buf->len = RECV_BUFFER_SIZE;
+    buf->bid = bid;
+
+    __atomic_store_n(&s_buf_ring->tail, ++s_buf_tail, __ATOMIC_RELEASE);
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _recv_complete(const struct io_uring_cqe *cqe)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const uint64_t user_data = cqe->user_data >> 2;
+
+    const bool more = (cqe->flags & IORING_CQE_F_MORE) != 0U;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if((cqe->flags & IORING_CQE_F_BUFFER) != 0U)
+    {
+        const uint16_t bid = (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+        s_recvs++;
+
+        s_recv_bytes += cqe->res > 0 ? (uint64_t) cqe->res : 0U;
+
+        s_recv_callback(user_data, s_recv_buffs + (size_t) bid * RECV_BUFFER_SIZE, cqe->res, more);
+
+        /* The callback copied what it did not parse */
+
+        _recv_recycle(bid);
+    }
+    else
+    {
+        if(cqe->res == -ENOBUFS)
+        {
+            s_recv_nobufs++;
+        }
+
+        s_recv_callback(user_data, NULL, cqe->res, more);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static size_t _reap(void)
+{
+    size_t result = 0U;
+
+    /* The head is read again on every entry, a callback may reap in turn */
+
+    for(unsigned head; (head = *s_cq_head) != __atomic_load_n(s_cq_tail, __ATOMIC_ACQUIRE); result++)
+    {
+        const struct io_uring_cqe cqe = s_cqes[head & *s_cq_mask];
+
+        __atomic_store_n(s_cq_head, head + 1U, __ATOMIC_RELEASE);
+
+        /**/ if((cqe.user_data & TAG_MASK) == ZC_TAG)
+        {
+            _zc_complete(&cqe);
+        }
+        else if((cqe.user_data & TAG_MASK) == RECV_TAG)
+        {
+            _recv_complete(&cqe);
+        }
+        else if((cqe.user_data & TAG_MASK) == CANCEL_TAG)
+        {
+            s_inflight--;
+        }
+        else
+        {
+            /* Plain sends always go back to the caller, whoever reaps them */
+
+            s_inflight--;
+
+            s_callback(cqe.user_data, cqe.res);
+        }
+    }
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static struct io_uring_sqe *_sqe(uint8_t kind)
+{
+    const unsigned idx = *s_sq_tail & *s_sq_mask;
+
+    struct io_uring_sqe *sqe = &s_sqes[idx];
+
+    memset(sqe, 0x00, sizeof(struct io_uring_sqe));
+
+    s_sq_array[idx] = idx;
+
+    s_sq_kinds[idx] = kind;
+
+    return sqe;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _push(uint8_t kind)
+{
+    __atomic_store_n(s_sq_tail, *s_sq_tail + 1U, __ATOMIC_RELEASE);
+
+    s_queued++;
+
+    if(kind != KIND_RECV)
+    {
+        s_queued_waits++;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_init(unsigned entries)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct io_uring_params params;
+
+    memset(&params, 0x00, sizeof(params));
+
+    s_fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+
+    if(s_fd < 0)
+    {
+        return false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    s_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    s_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    s_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if((params.features & IORING_FEAT_SINGLE_MMAP) != 0U)
+    {
+        s_sq_size = s_cq_size = s_sq_size > s_cq_size ? s_sq_size : s_cq_size;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    s_sq_ptr = mmap(NULL, s_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s_fd, IORING_OFF_SQ_RING);
+
+    if(s_sq_ptr == MAP_FAILED)
+    {
+        s_sq_ptr = NULL;
+
+        goto _err;
+    }
+
+    if((params.features & IORING_FEAT_SINGLE_MMAP) != 0U)
+    {
+        s_cq_ptr = s_sq_ptr;
+    }
+    else
+    {
+        s_cq_ptr = mmap(NULL, s_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s_fd, IORING_OFF_CQ_RING);
+
+        if(s_cq_ptr == MAP_FAILED)
+        {
+            s_cq_ptr = NULL;
+
+            goto _err;
+        }
+    }
+
+    s_sqes = mmap(NULL, s_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s_fd, IORING_OFF_SQES);
+
+    if(s_sqes == MAP_FAILED)
+    {
+        s_sqes = NULL;
+
+        goto _err;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    s_sq_tail = (unsigned *) ((uint8_t *) s_sq_ptr + params.sq_off.tail);
+    s_sq_mask = (unsigned *) ((uint8_t *) s_sq_ptr + params.sq_off.ring_mask);
+    s_sq_array = (unsigned *) ((uint8_t *) s_sq_ptr + params.sq_off.array);
+
+    s_cq_head = (unsigned *) ((uint8_t *) s_cq_ptr + params.cq_off.head);
+    s_cq_tail = (unsigned *) ((uint8_t *) s_cq_ptr + params.cq_off.tail);
+    s_cq_mask = (unsigned *) ((uint8_t *) s_cq_ptr + params.cq_off.ring_mask);
+
+    s_cqes = (struct io_uring_cqe *) ((uint8_t *) s_cq_ptr + params.cq_off.cqes);
+
+    s_entries = params.sq_entries;
+
+    s_sq_kinds = nyx_memory_alloc(s_entries * sizeof(uint8_t));
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return true;
+
+_err:
+    nyx_uring_free();
+
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_uring_free(void)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Frames sent zero-copy stay pinned until the kernel notifies it no longer reads them */
+
+    for(unsigned waited_ms = 0U; s_zc_list != NULL && s_cqes != NULL && waited_ms < ZC_DRAIN_MS; waited_ms += 10U)
+    {
+        struct __kernel_timespec ts = {0, 10L * 1000L * 1000L};
+
+        struct io_uring_getevents_arg arg = {0U, 0U, 0U, (uint64_t) (uintptr_t) &ts};
+
+        syscall(__NR_io_uring_enter, s_fd, 0U, 1U, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+        _reap();
+    }
+
+    /* Still not notified, the kernel holds its own page references */
+
+    while(s_zc_list != NULL)
+    {
+        _zc_unpin(s_zc_list);
+    }
+
+    s_zc_waiting = NULL;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_sqes != NULL) {
+        munmap(s_sqes, s_sqes_size);
+        s_sqes = NULL;
+    }
+
+    if(s_cq_ptr != NULL && s_cq_ptr != s_sq_ptr) {
+        munmap(s_cq_ptr, s_cq_size);
+    }
+
+    s_cq_ptr = NULL;
+
+    if(s_sq_ptr != NULL) {
+        munmap(s_sq_ptr, s_sq_size);
+        s_sq_ptr = NULL;
+    }
+
+    if(s_fd >= 0) {
+        close(s_fd);
+        s_fd = -1;
+    }
+
+    /* The receives died with the ring, the kernel no longer writes to their buffers */
+
+    if(s_recv_buffs != NULL) {
+        munmap(s_recv_buffs, (size_t) RECV_BUFFERS * RECV_BUFFER_SIZE);
+        s_recv_buffs = NULL;
+    }
+
+    if(s_buf_ring != NULL) {
+        munmap(s_buf_ring, RECV_BUFFERS * sizeof(struct io_uring_buf));
+        s_buf_ring = NULL;
+    }
+
+    if(s_sq_kinds != NULL) {
+        nyx_memory_free(s_sq_kinds);
+        s_sq_kinds = NULL;
+    }
+
+    s_recv_callback = NULL;
+
+    s_entries = 0U;
+    s_queued = 0U;
+    s_inflight = 0U;
+    s_queued_waits = 0U;
+
+    s_disabled = false;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_uring_disable(void)
+{
+    /* Safe from a completion callback, the ring is torn down once every completion was reaped */
+
+    s_disabled = true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_enabled(void)
+{
+    return s_fd >= 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_send(int fd, BUFF_t buff, size_t size, uint64_t user_data)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_fd < 0 || s_queued == s_entries)
+    {
+        return false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct io_uring_sqe *sqe = _sqe(KIND_SEND);
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buff;
+    sqe->len = (uint32_t) size;
+    sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+
+    _push(KIND_SEND);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+size_t nyx_uring_submit(void (* callback)(uint64_t user_data, int32_t result))
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_fd < 0)
+    {
+        return 0U;
+    }
+
+    s_callback = callback;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Nothing to submit, zero-copy notifications and receives may still be waiting */
+
+    size_t result = nyx_uring_poll();
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Sends are non-blocking, so waiting for all the completions is cheap. A signal may cut the wait short: no send */
+    /* may stay in flight past this call, or the caller would submit the same bytes again on the next iteration.     */
+    /* Multishot receives complete whenever data arrives, they are submitted here but never waited for.              */
+
+    while(s_queued > 0U || s_inflight > 0U)
+    {
+        const long n = syscall(__NR_io_uring_enter, s_fd, s_queued, s_inflight + s_queued_waits, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        s_enters++;
+
+        if(n < 0)
+        {
+            if(errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            {
+                /* The ring is unusable, the entries never submitted are taken back, their bytes go through epoll */
+
+                __atomic_store_n(s_sq_tail, *s_sq_tail - s_queued, __ATOMIC_RELEASE);
+
+                s_queued = 0U;
+
+                s_queued_waits = 0U;
+
+                s_disabled = true;
+
+                _reap();
+
+                break;
+            }
+        }
+        else
+        {
+            /* Entries are consumed in order */
+
+            for(unsigned tail = *s_sq_tail - s_queued, end = tail + (unsigned) n; tail != end; tail++)
+            {
+                const uint8_t kind = s_sq_kinds[tail & *s_sq_mask];
+
+                if(kind != KIND_RECV)
+                {
+                    s_queued_waits--;
+
+                    s_inflight++;
+                }
+
+                if(kind == KIND_SEND)
+                {
+                    s_sends++;
+                }
+            }
+
+            s_queued -= (unsigned) n;
+        }
+
+        result += _reap();
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_disabled)
+    {
+        nyx_uring_free();
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+int32_t nyx_uring_send_zc(int fd, struct nyx_frame *frame, size_t offset)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Not while another zero-copy send waits, a receive callback may get here from within its reap loop */
+
+    if(s_fd < 0 || s_queued > 0U || s_inflight > 0U || s_zc_waiting != NULL)
+    {
+        return -EBUSY;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct _zc_send *zc = _zc_pin(frame);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const unsigned tail = *s_sq_tail;
+
+    const unsigned idx = tail & *s_sq_mask;
+
+    struct io_uring_sqe *sqe = &s_sqes[idx];
+
+    memset(sqe, 0x00, sizeof(struct io_uring_sqe));
+
+    sqe->opcode = IORING_OP_SEND_ZC;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) (frame->data + offset);
+    sqe->len = (uint32_t) (frame->size - offset);
+    sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    sqe->ioprio = IORING_SEND_ZC_REPORT_USAGE;
+    sqe->user_data = (uint64_t) (uintptr_t) zc | ZC_TAG;
+
+    s_sq_array[idx] = idx;
+
+    __atomic_store_n(s_sq_tail, tail + 1U, __ATOMIC_RELEASE);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    s_zc_waiting = zc;
+
+    const long n = syscall(__NR_io_uring_enter, s_fd, 1U, 1U, IORING_ENTER_GETEVENTS, NULL, 0);
+
+    s_enters++;
+
+    if(n < 0)
+    {
+        /* Not consumed by the kernel, the entry is taken back */
+
+        __atomic_store_n(s_sq_tail, tail, __ATOMIC_RELEASE);
+
+        const int32_t result = (int32_t) -errno;
+
+        s_zc_waiting = NULL;
+
+        _zc_unpin(zc);
+
+        return result;
+    }
+
+    s_zc_sends++;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* The send result comes first, the notification once the pages are released */
+
+    for(_reap(); s_zc_waiting != NULL; _reap())
+    {
+        syscall(__NR_io_uring_enter, s_fd, 0U, 1U, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        s_enters++;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return s_zc_result;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_recv_init(int event_fd, void (* callback)(uint64_t user_data, BUFF_t buff, int32_t result, bool more))
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_fd < 0)
+    {
+        return false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* Only completions posted outside of io_uring_enter() signal the event, i.e. the receives */
+
+    if(syscall(__NR_io_uring_register, s_fd, IORING_REGISTER_EVENTFD_ASYNC, &event_fd, 1U) < 0)
+    {
+        return false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    s_buf_ring = mmap(NULL, RECV_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+    if(s_buf_ring == MAP_FAILED)
+    {
+        s_buf_ring = NULL;
+
+        goto _err;
+    }
+
+    s_recv_buffs = mmap(NULL, (size_t) RECV_BUFFERS * RECV_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+    if(s_recv_buffs == MAP_FAILED)
+    {
+        s_recv_buffs = NULL;
+
+        goto _err;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    struct io_uring_buf_reg reg;
+
+    memset(&reg, 0x00, sizeof(reg));
+
+    reg.ring_addr = (uint64_t) (uintptr_t) s_buf_ring;
+    reg.ring_entries = RECV_BUFFERS;
+    reg.bgid = RECV_GROUP;
+
+    if(syscall(__NR_io_uring_register, s_fd, IORING_REGISTER_PBUF_RING, &reg, 1U) < 0)
+    {
+        goto _err;
+    }
+
+    for(uint16_t bid = 0U; bid < RECV_BUFFERS; bid++)
+    {
+        _recv_recycle(bid);
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    s_recv_callback = callback;
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return true;
+
+_err:
+    syscall(__NR_io_uring_register, s_fd, IORING_UNREGISTER_EVENTFD, NULL, 0U);
+
+    if(s_recv_buffs != NULL) {
+        munmap(s_recv_buffs, (size_t) RECV_BUFFERS * RECV_BUFFER_SIZE);
+        s_recv_buffs = NULL;
+    }
+
+    if(s_buf_ring != NULL) {
+        munmap(s_buf_ring, RECV_BUFFERS * sizeof(struct io_uring_buf));
+        s_buf_ring = NULL;
+    }
+
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_recv_enabled(void)
+{
+    return s_fd >= 0 && s_recv_callback != NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_recv(int fd, uint64_t user_data)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_fd < 0 || s_recv_callback == NULL || s_queued == s_entries)
+    {
+        return false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* One submission keeps on receiving into the group's buffers until it fails, is cancelled or they run out */
+
+    struct io_uring_sqe *sqe = _sqe(KIND_RECV);
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_GROUP;
+    sqe->user_data = (user_data << 2) | RECV_TAG;
+
+    _push(KIND_RECV);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_recv_cancel(uint64_t user_data)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_fd < 0 || s_recv_callback == NULL || s_queued == s_entries)
+    {
+        return false;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    /* The receive completes in turn, with -ECANCELED and without IORING_CQE_F_MORE */
+
+    struct io_uring_sqe *sqe = _sqe(KIND_CANCEL);
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (user_data << 2) | RECV_TAG;
+    sqe->user_data = CANCEL_TAG;
+
+    _push(KIND_CANCEL);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+size_t nyx_uring_poll(void)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    if(s_fd < 0)
+    {
+        return 0U;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    return _reap();
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_uring_stats(uint64_t *enters, uint64_t *sends)
+{
+    *enters = s_enters;
+    *sends = s_sends;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_uring_zc_stats(uint64_t *sends, uint64_t *bytes, uint64_t *copied, uint64_t *pinned)
+{
+    *sends = s_zc_sends;
+    *bytes = s_zc_bytes;
+    *copied = s_zc_copied;
+    *pinned = s_zc_pinned;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_uring_recv_stats(uint64_t *recvs, uint64_t *bytes, uint64_t *nobufs)
+{
+    *recvs = s_recvs;
+    *bytes = s_recv_bytes;
+    *nobufs = s_recv_nobufs;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+#else
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_init(__NYX_UNUSED__ unsigned entries)
+{
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_uring_free(void)
+{
+    /* do nothing */
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_uring_disable(void)
+{
+    /* do nothing */
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_enabled(void)
+{
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_send(__NYX_UNUSED__ int fd, __NYX_UNUSED__ BUFF_t buff, __NYX_UNUSED__ size_t size, __NYX_UNUSED__ uint64_t user_data)
+{
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+size_t nyx_uring_submit(__NYX_UNUSED__ void (* callback)(uint64_t user_data, int32_t result))
+{
+    return 0U;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+int32_t nyx_uring_send_zc(__NYX_UNUSED__ int fd, __NYX_UNUSED__ struct nyx_frame *frame, __NYX_UNUSED__ size_t offset)
+{
+    return -EOPNOTSUPP;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_recv_init(__NYX_UNUSED__ int event_fd, __NYX_UNUSED__ void (* callback)(uint64_t user_data, BUFF_t buff, int32_t result, bool more))
+{
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_recv_enabled(void)
+{
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_recv(__NYX_UNUSED__ int fd, __NYX_UNUSED__ uint64_t user_data)
+{
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+bool nyx_uring_recv_cancel(__NYX_UNUSED__ uint64_t user_data)
+{
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+size_t nyx_uring_poll(void)
+{
+    return 0U;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_uring_stats(uint64_t *enters, uint64_t *sends)
+{
+    *enters = 0U;
+    *sends = 0U;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_uring_zc_stats(uint64_t *sends, uint64_t *bytes, uint64_t *copied, uint64_t *pinned)
+{
+    *sends = 0U;
+    *bytes = 0U;
+    *copied = 0U;
+    *pinned = 0U;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_uring_recv_stats(uint64_t *recvs, uint64_t *bytes, uint64_t *nobufs)
+{
+    *recvs = 0U;
+    *bytes = 0U;
+    *nobufs = 0U;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+#endif
+/*--------------------------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,222 @@
+/* NyxStream
+ * Author: Jérôme ODIER <jerome.odier@lpsc.in2p3.fr>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "nyx-stream.h"
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+#define WHEEL_MASK ((1U << NYX_WHEEL_BITS) - 1U)
+
+#define WHEEL_SPAN(level) (1LLU << (NYX_WHEEL_BITS * (level)))
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _link(struct nyx_timer **head, struct nyx_timer *timer)
+{
+    timer->next = *head;
+    timer->pprev = head;
+
+    if(*head != NULL)
+    {
+        (*head)->pprev = &timer->next;
+    }
+
+    *head = timer;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _unlink(struct nyx_timer *timer)
+{
+    *timer->pprev = timer->next;
+
+    if(timer->next != NULL)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+static void _place(struct nyx_wheel *wheel, struct nyx_timer *timer)
+{
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    uint64_t deadline_ms = timer->deadline_ms;
+
+    if(deadline_ms <= wheel->now_ms)
+    {
+        deadline_ms = wheel->now_ms + 1U;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    const uint64_t delta = deadline_ms - wheel->now_ms;
+
+    if(delta >= WHEEL_SPAN(NYX_WHEEL_LEVELS))
+    {
+        /* Out of range, it will be cascaded again later... */
+
+        deadline_ms = wheel->now_ms + WHEEL_SPAN(NYX_WHEEL_LEVELS) - 1U;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    uint32_t level = 0U;
+
+    while(level < NYX_WHEEL_LEVELS - 1U && delta >= WHEEL_SPAN(level + 1U))
+    {
+        level++;
+    }
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+
+    _link(&wheel->slots[level][(deadline_ms >> (NYX_WHEEL_BITS * level)) & WHEEL_MASK], timer);
+
+    /*----------------------------------------------------------------------------------------------------------------*/
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_timer_init(struct nyx_timer *timer, void (* callback)(void *arg), void *arg)
+{
+    memset(timer, 0x00, sizeof(struct nyx_timer));
+
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_wheel_init(struct nyx_wheel *wheel, uint64_t now_ms)
+{
+    memset(wheel, 0x00, sizeof(struct nyx_wheel));
+
+    wheel->now_ms = now_ms;
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_wheel_schedule(struct nyx_wheel *wheel, struct nyx_timer *timer, uint64_t deadline_ms)
+{
+    if(timer->pprev != NULL)
+    {
+        _unlink(timer);
+    }
+    else
+    {
+        wheel->count++;
+    }
+
+    timer->deadline_ms = deadline_ms;
+
+    _place(wheel, timer);
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_wheel_cancel(struct nyx_wheel *wheel, struct nyx_timer *timer)
+{
+    if(timer->pprev != NULL)
+    {
+        _unlink(timer);
+
+        wheel->count--;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/
+
+void nyx_wheel_advance(struct nyx_wheel *wheel, uint64_t now_ms)
+{
+    while(wheel->now_ms < now_ms)
+    {
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        if(wheel->count == 0U)
+        {
+            /* Nothing scheduled, jump ahead... */
+
+            wheel->now_ms = now_ms;
+
+            break;
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        const uint64_t tick = ++wheel->now_ms;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* CASCADE                                                                                                    */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        for(uint32_t level = 1U; level < NYX_WHEEL_LEVELS && (tick & (WHEEL_SPAN(level) - 1U)) == 0U; level++)
+        {
+            struct nyx_timer **slot = &wheel->slots[level][(tick >> (NYX_WHEEL_BITS * level)) & WHEEL_MASK];
+
+            while(*slot != NULL)
+            {
+                struct nyx_timer *timer = *slot;
+
+                _unlink(timer);
+
+                if(timer->deadline_ms <= tick)
+                {
+                    _link(&wheel->slots[0][tick & WHEEL_MASK], timer);
+                }
+                else
+                {
+                    _place(wheel, timer);
+                }
+            }
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+        /* EXPIRE                                                                                                     */
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        struct nyx_timer **slot = &wheel->slots[0][tick & WHEEL_MASK];
+
+        if(*slot == NULL)
+        {
+            continue;
+        }
+
+        wheel->expired = *slot;
+        wheel->expired->pprev = &wheel->expired;
+        *slot = NULL;
+
+        /*------------------------------------------------------------------------------------------------------------*/
+
+        while(wheel->expired != NULL)
+        {
+            struct nyx_timer *timer = wheel->expired;
+
+            _unlink(timer);
+
+            if(timer->deadline_ms > tick)
+            {
+                _place(wheel, timer);
+            }
+            else
+            {
+                wheel->count--;
+
+                timer->callback(timer->arg);
+            }
+        }
+
+        /*------------------------------------------------------------------------------------------------------------*/
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------------------*/